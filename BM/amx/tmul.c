@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <sched.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
 #include <pthread.h>
@@ -19,6 +20,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <immintrin.h>
+#include <cpuid.h>
 
 #define MIN_THREAD_NUM 1
 #define XFEATURE_XTILEDATA 18
@@ -26,6 +28,7 @@
 #define ROW_NUM 16
 #define COL_NUM 64
 #define FUTEX_VAL 0x5E5E5E5E
+#define DEFAULT_WORKER_CPU 1
 
 #define DPBD(c, x, y, type1, type2)								\
 	{														\
@@ -72,6 +75,31 @@ enum {
 #endif
 } ENUM_INSTRUCTION_TYPE;
 
+enum {
+	PLACE_ONE_CPU = 0,
+	PLACE_PER_CORE,
+	PLACE_CPU_LIST,
+	PLACE_PER_NODE,
+} ENUM_PLACEMENT;
+
+enum {
+	CALC_SCALAR = 0,
+	CALC_AVX2,
+	CALC_AVX512,
+	CALC_AUTO,
+	CALC_COMPARE,
+} ENUM_CALC_ISA;
+
+enum {
+	LAT_TILE_INIT = 0,
+	LAT_TILE_DATA,
+	LAT_TILE_RELEASED,
+	LAT_STATE_NUM,
+} ENUM_LATENCY_STATE;
+
+#define LAT_HIST_BUCKETS 40
+#define COMPARE_ROUNDS 100
+
 struct __tile_config {
 	uint8_t palette_id;
 	uint8_t start_row;
@@ -93,13 +121,57 @@ struct __tile {
 	int32_t colsb;
 };
 
+/* Row number and column number in byte of each of the 8 tile registers */
+struct tile_shape {
+	uint8_t rows[8];
+	uint16_t colsb[8];
+};
+
+/*
+ * TSC cycles taken by one break reason in one tile state.
+ * hist[n] counts breaks of [2^n, 2^(n+1)) cycles.
+ */
+struct break_latency {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t hist[LAT_HIST_BUCKETS];
+};
+
+/* What a sub-thread did, written by itself and printed by main() */
+struct thread_report {
+	uint32_t done_cycles;
+	int32_t cpu;
+	double wall_sec;
+};
+
 static bool *thread_done;
 static int32_t *futex_ptr;
-struct __tile *buf_tile1, *buf_tile2, *buf_tile3, *buf_tile4;
+struct __tile *buf_tile1, *buf_tile2, *buf_tile3;
 static int32_t thread_num = MIN_THREAD_NUM;
 static int32_t break_reason = BREAK_BY_NOTHING;
 static uint32_t cycles = 1;
 static int32_t ins_type = INS_TDPBSSD;
+static int32_t placement = PLACE_ONE_CPU;
+static int32_t place_cpu = DEFAULT_WORKER_CPU;
+static cpu_set_t place_list;
+static cpu_set_t *thread_mask;
+static struct thread_report *thread_report;
+static bool bench_mode;
+static bool bench_all = true;
+static uint32_t verify_interval = 1000;
+static double *bench_sec;
+static double *bench_start;
+static pthread_barrier_t bench_barrier;
+static int32_t calc_isa = CALC_AUTO;
+static struct tile_shape tile_shape;
+static struct tile_shape *sweep_shapes;
+static int32_t shape_num = 1;
+static bool sweep_mode;
+static bool latency_mode;
+static struct break_latency *break_lat;
+static bool amx_fp16;
 
 /*
  * convert_fp32_to_bf16() - Convert data format.
@@ -231,21 +303,25 @@ static uint64_t do_syscall(uint64_t nr, uint64_t rdi, uint64_t rsi, uint64_t rdx
 	return rtn;
 }
 
-static uint32_t get_random(void)
+/*
+ * get_random() - Fill a buffer with random values.
+ * @buf: The buffer.
+ * @count: Number of values, read from /dev/random in one go.
+ *
+ * Values that could not be read are 1.
+ */
+static void get_random(uint32_t *buf, size_t count)
 {
-	uint32_t random_val = 0;
 	FILE *fp = fopen("/dev/random", "r");
 	size_t num = 0;
 
 	if (fp) {
-		num = fread((void *)&random_val, sizeof(random_val), 1, fp);
+		num = fread((void *)buf, sizeof(*buf), count, fp);
 		fclose(fp);
 	}
 
-	if (num >= 1)
-		return random_val;
-	else
-		return 1;
+	for (; num < count; num++)
+		buf[num] = 1;
 }
 
 /*
@@ -314,25 +390,25 @@ static void init_dword_tile(struct __tile *tile_ptr, uint8_t rows, uint8_t colsb
 	int32_t i, j;
 	int32_t *ptr = (int32_t *)tile_ptr->buf;
 	int32_t cols = colsb / 4;
+	uint32_t random_val[ROW_NUM * COL_NUM / 4];
 
 	tile_ptr->rows = rows;
 	tile_ptr->colsb = colsb;
 
+	get_random(random_val, rows * cols);
 	for (i = 0; i < rows; i++)
 		for (j = 0; j < cols; j++)
-			ptr[i * cols + j] = get_random() + i + j;
+			ptr[i * cols + j] = random_val[i * cols + j] + i + j;
 }
 
 /*
  * init_tile_config() - Init the tile configuration structure.
  * @dst: The tile configuration structure.
- * @rows: Row number of the matrix.
- * @colsb: Column number in byte of the matrix.
+ * @shape: Row number and column number in byte of every tile register.
  *
- * Init the tile configuration structure.
- * Fixedly using tile 0, 1 and 2.
+ * Init the tile configuration structure and program it to TILECFG.
  */
-static void init_tile_config(union __union_tile_config *dst, uint8_t rows, uint8_t colsb)
+static void init_tile_config(union __union_tile_config *dst, const struct tile_shape *shape)
 {
 	int32_t i;
 
@@ -347,29 +423,10 @@ static void init_tile_config(union __union_tile_config *dst, uint8_t rows, uint8
 		dst->s.reserved_2[i] = 0;
 	}
 
-	dst->s.colsb[0] = colsb;
-	dst->s.rows[0] = rows;
-
-	dst->s.colsb[1] = colsb;
-	dst->s.rows[1] = rows;
-
-	dst->s.colsb[2] = colsb;
-	dst->s.rows[2] = rows;
-
-	dst->s.colsb[3] = colsb;
-	dst->s.rows[3] = rows;
-
-	dst->s.colsb[4] = colsb;
-	dst->s.rows[4] = rows;
-
-	dst->s.colsb[5] = colsb;
-	dst->s.rows[5] = rows;
-
-	dst->s.colsb[6] = colsb;
-	dst->s.rows[6] = rows;
-
-	dst->s.colsb[7] = colsb;
-	dst->s.rows[7] = rows;
+	for (i = 0; i < 8; i++) {
+		dst->s.colsb[i] = shape->colsb[i];
+		dst->s.rows[i] = shape->rows[i];
+	}
 
 	asm volatile("ldtilecfg %0" : : "m" (dst->a));
 }
@@ -578,6 +635,277 @@ static void calc_matrix_tdpbuud(struct __tile *dst, struct __tile *src1, struct
 			}
 }
 
+/*
+ * The vector reference kernels below widen both sources once, with the
+ * same scalar conversions as above, and then do the multiplies and adds
+ * of the scalar kernels in the same order per element: for FP pairs
+ * dst += (a0 * b0) + (a1 * b1) without FMA (built with -ffp-contract=off),
+ * for bytes a wrapping 32-bit sum of the 4 products. So they are bit
+ * identical to the scalar kernels as long as no NaN is involved; a NaN
+ * result is NaN in both, but which input NaN's payload it carries
+ * depends on the operand order the compiler picked. -r compare checks
+ * this on random inputs.
+ */
+#define MAX_K (COL_NUM / 4)
+#define MAX_N (COL_NUM / 4)
+
+static const char *calc_isa_name[] = { "scalar", "avx2", "avx512", "auto", "compare" };
+
+/*
+ * widen_fp_pairs() - Convert BF16/FP16 pairs of both sources to FP32.
+ * @fp16: true for FP16, false for BF16.
+ * @a: M x 2K, the first source as it is laid out.
+ * @b0: K x N, the even element of each pair of the second source.
+ * @b1: K x N, the odd element of each pair of the second source.
+ */
+static void widen_fp_pairs(bool fp16, struct __tile *src1, struct __tile *src2,
+			   float *a, float *b0, float *b1)
+{
+	uint16_t *src1_buf = (uint16_t *)src1->buf;
+	uint16_t *src2_buf = (uint16_t *)src2->buf;
+	int32_t M = src1->rows;
+	int32_t K = src1->colsb / 4;
+	int32_t N = src2->colsb / 4;
+	int32_t i;
+
+#ifdef FP16
+	if (fp16) {
+		for (i = 0; i < M * K * 2; i++)
+			a[i] = convert_fp16_to_fp32(src1_buf[i]);
+		for (i = 0; i < K * N; i++) {
+			b0[i] = convert_fp16_to_fp32(src2_buf[i * 2 + 0]);
+			b1[i] = convert_fp16_to_fp32(src2_buf[i * 2 + 1]);
+		}
+		return;
+	}
+#else
+	(void)fp16;
+#endif
+	for (i = 0; i < M * K * 2; i++)
+		a[i] = convert_bf16_to_fp32(src1_buf[i]);
+	for (i = 0; i < K * N; i++) {
+		b0[i] = convert_bf16_to_fp32(src2_buf[i * 2 + 0]);
+		b1[i] = convert_bf16_to_fp32(src2_buf[i * 2 + 1]);
+	}
+}
+
+/*
+ * widen_dwords() - Sign or zero extend the bytes of both sources.
+ * @a: M x K x 4, the bytes of the first source.
+ * @b: K x 4 x N, byte j of the second source's dword (k, n) at (k, j, n).
+ */
+static void widen_dwords(struct __tile *src1, struct __tile *src2, bool src1_signed,
+			 bool src2_signed, int32_t *a, int32_t *b)
+{
+	uint8_t *src1_buf = src1->buf;
+	uint8_t *src2_buf = src2->buf;
+	int32_t M = src1->rows;
+	int32_t K = src1->colsb / 4;
+	int32_t N = src2->colsb / 4;
+	int32_t i, k, j, n;
+
+	for (i = 0; i < M * K * 4; i++)
+		a[i] = src1_signed ? (int8_t)src1_buf[i] : src1_buf[i];
+
+	for (k = 0; k < K; k++)
+		for (j = 0; j < 4; j++)
+			for (n = 0; n < N; n++) {
+				uint8_t v = src2_buf[(k * N + n) * 4 + j];
+
+				b[(k * 4 + j) * N + n] = src2_signed ? (int8_t)v : v;
+			}
+}
+
+__attribute__((target("avx512f")))
+static void calc_fp_pairs_avx512(float *dst, float *a, float *b0, float *b1,
+				 int32_t M, int32_t K, int32_t N)
+{
+	int32_t m, k, n;
+
+	for (m = 0; m < M; m++) {
+		for (n = 0; n + 16 <= N; n += 16) {
+			__m512 d = _mm512_loadu_ps(&dst[m * N + n]);
+
+			for (k = 0; k < K; k++) {
+				__m512 p0 = _mm512_mul_ps(_mm512_set1_ps(a[m * K * 2 + k * 2 + 0]),
+							  _mm512_loadu_ps(&b0[k * N + n]));
+				__m512 p1 = _mm512_mul_ps(_mm512_set1_ps(a[m * K * 2 + k * 2 + 1]),
+							  _mm512_loadu_ps(&b1[k * N + n]));
+
+				d = _mm512_add_ps(d, _mm512_add_ps(p0, p1));
+			}
+			_mm512_storeu_ps(&dst[m * N + n], d);
+		}
+		for (; n < N; n++)
+			for (k = 0; k < K; k++)
+				dst[m * N + n] += (a[m * K * 2 + k * 2 + 0] * b0[k * N + n]) +
+						  (a[m * K * 2 + k * 2 + 1] * b1[k * N + n]);
+	}
+}
+
+__attribute__((target("avx2")))
+static void calc_fp_pairs_avx2(float *dst, float *a, float *b0, float *b1,
+			       int32_t M, int32_t K, int32_t N)
+{
+	int32_t m, k, n;
+
+	for (m = 0; m < M; m++) {
+		for (n = 0; n + 8 <= N; n += 8) {
+			__m256 d = _mm256_loadu_ps(&dst[m * N + n]);
+
+			for (k = 0; k < K; k++) {
+				__m256 p0 = _mm256_mul_ps(_mm256_set1_ps(a[m * K * 2 + k * 2 + 0]),
+							  _mm256_loadu_ps(&b0[k * N + n]));
+				__m256 p1 = _mm256_mul_ps(_mm256_set1_ps(a[m * K * 2 + k * 2 + 1]),
+							  _mm256_loadu_ps(&b1[k * N + n]));
+
+				d = _mm256_add_ps(d, _mm256_add_ps(p0, p1));
+			}
+			_mm256_storeu_ps(&dst[m * N + n], d);
+		}
+		for (; n < N; n++)
+			for (k = 0; k < K; k++)
+				dst[m * N + n] += (a[m * K * 2 + k * 2 + 0] * b0[k * N + n]) +
+						  (a[m * K * 2 + k * 2 + 1] * b1[k * N + n]);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void calc_dwords_avx512(uint32_t *dst, int32_t *a, int32_t *b,
+			       int32_t M, int32_t K, int32_t N)
+{
+	int32_t m, k, j, n;
+
+	for (m = 0; m < M; m++) {
+		for (n = 0; n + 16 <= N; n += 16) {
+			__m512i d = _mm512_loadu_si512(&dst[m * N + n]);
+
+			for (k = 0; k < K; k++)
+				for (j = 0; j < 4; j++)
+					d = _mm512_add_epi32(d, _mm512_mullo_epi32(
+						_mm512_set1_epi32(a[(m * K + k) * 4 + j]),
+						_mm512_loadu_si512(&b[(k * 4 + j) * N + n])));
+			_mm512_storeu_si512(&dst[m * N + n], d);
+		}
+		for (; n < N; n++)
+			for (k = 0; k < K; k++)
+				for (j = 0; j < 4; j++)
+					dst[m * N + n] += (uint32_t)a[(m * K + k) * 4 + j] *
+							  (uint32_t)b[(k * 4 + j) * N + n];
+	}
+}
+
+__attribute__((target("avx2")))
+static void calc_dwords_avx2(uint32_t *dst, int32_t *a, int32_t *b,
+			     int32_t M, int32_t K, int32_t N)
+{
+	int32_t m, k, j, n;
+
+	for (m = 0; m < M; m++) {
+		for (n = 0; n + 8 <= N; n += 8) {
+			__m256i d = _mm256_loadu_si256((__m256i *)&dst[m * N + n]);
+
+			for (k = 0; k < K; k++)
+				for (j = 0; j < 4; j++)
+					d = _mm256_add_epi32(d, _mm256_mullo_epi32(
+						_mm256_set1_epi32(a[(m * K + k) * 4 + j]),
+						_mm256_loadu_si256((__m256i *)&b[(k * 4 + j) * N + n])));
+			_mm256_storeu_si256((__m256i *)&dst[m * N + n], d);
+		}
+		for (; n < N; n++)
+			for (k = 0; k < K; k++)
+				for (j = 0; j < 4; j++)
+					dst[m * N + n] += (uint32_t)a[(m * K + k) * 4 + j] *
+							  (uint32_t)b[(k * 4 + j) * N + n];
+	}
+}
+
+/*
+ * select_calc_isa() - Pick the reference kernels for -r.
+ *
+ * Return:
+ * true - OK
+ * false - The CPU does not support the requested ISA
+ */
+static bool select_calc_isa(void)
+{
+	if (calc_isa == CALC_AUTO) {
+		if (__builtin_cpu_supports("avx512f"))
+			calc_isa = CALC_AVX512;
+		else if (__builtin_cpu_supports("avx2"))
+			calc_isa = CALC_AVX2;
+		else
+			calc_isa = CALC_SCALAR;
+		return true;
+	}
+
+	if ((calc_isa == CALC_AVX512 && !__builtin_cpu_supports("avx512f")) ||
+	    (calc_isa == CALC_AVX2 && !__builtin_cpu_supports("avx2"))) {
+		printf("CPU does not support %s reference kernels\n", calc_isa_name[calc_isa]);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * calc_matrix() - Software algorithm for an instruction type.
+ * @type: The instruction type.
+ * @dst: The product of matrix multiplication.
+ * @src1: The first multiplier.
+ * @src2: The second multiplier.
+ */
+static void calc_matrix(int32_t type, struct __tile *dst, struct __tile *src1,
+			struct __tile *src2)
+{
+	float fa[ROW_NUM * MAX_K * 2], fb0[MAX_K * MAX_N], fb1[MAX_K * MAX_N];
+	int32_t da[ROW_NUM * MAX_K * 4], db[MAX_K * 4 * MAX_N];
+	int32_t M = src1->rows;
+	int32_t K = src1->colsb / 4;
+	int32_t N = src2->colsb / 4;
+	bool fp = type == INS_TDPBF16PS;
+	bool fp16 = false;
+
+#ifdef FP16
+	fp16 = type == INS_TDPFP16PS;
+	fp |= fp16;
+#endif
+
+	if (calc_isa == CALC_SCALAR) {
+		if (type == INS_TDPBF16PS)
+			calc_matrix_tdpbf16ps(dst, src1, src2);
+#ifdef FP16
+		else if (type == INS_TDPFP16PS)
+			calc_matrix_tdpfp16ps(dst, src1, src2);
+#endif
+		else if (type == INS_TDPBSSD)
+			calc_matrix_tdpbssd(dst, src1, src2);
+		else if (type == INS_TDPBSUD)
+			calc_matrix_tdpbsud(dst, src1, src2);
+		else if (type == INS_TDPBUSD)
+			calc_matrix_tdpbusd(dst, src1, src2);
+		else if (type == INS_TDPBUUD)
+			calc_matrix_tdpbuud(dst, src1, src2);
+		return;
+	}
+
+	if (fp) {
+		widen_fp_pairs(fp16, src1, src2, fa, fb0, fb1);
+		if (calc_isa == CALC_AVX512)
+			calc_fp_pairs_avx512((float *)dst->buf, fa, fb0, fb1, M, K, N);
+		else
+			calc_fp_pairs_avx2((float *)dst->buf, fa, fb0, fb1, M, K, N);
+		return;
+	}
+
+	widen_dwords(src1, src2, type == INS_TDPBSSD || type == INS_TDPBSUD,
+		     type == INS_TDPBSSD || type == INS_TDPBUSD, da, db);
+	if (calc_isa == CALC_AVX512)
+		calc_dwords_avx512((uint32_t *)dst->buf, da, db, M, K, N);
+	else
+		calc_dwords_avx2((uint32_t *)dst->buf, da, db, M, K, N);
+}
+
 static void tile_dpbf16ps(void)
 {
 	asm volatile("tdpbf16ps %tmm7, %tmm6, %tmm5");
@@ -769,6 +1097,10 @@ static void signal_handler(int32_t signum)
 {
 	int32_t current_cpu = sched_getcpu();
 
+	/* Keep printf(3) out of the measured breaks */
+	if (latency_mode)
+		return;
+
 	if (signum == SIGTRAP)
 		printf("Break by trap, current_cpu=%d\n", current_cpu);
 
@@ -824,199 +1156,1102 @@ static void thread_break(int32_t reason, uint32_t thread_idx)
 }
 
 /*
- * worker_thread() - The sub-thread entrance.
- * @arg: The index of sub-thread.
- *       Index from 0 to the total number of threads - 1.
+ * parse_cpu_list() - Parse a CPU list.
+ * @str: CPU list such as "0-3,8,10-11".
+ * @set: The CPU set to fill.
  *
- * Two results are generated by AMX/TMUL calculation procedure,
- * one is calculated by software, the other is calculated by TMUL.
- * Interrupt the AMX/TMUL calculation procedure by different reasons.
- * These reasons may cause context-switch by Kernel.
- * Check if the thread context is saved and restored correctly
- * by comparing the two results.
+ * Return:
+ * true - OK
+ * false - Abnormal
  */
-static void *worker_thread(void *arg)
+static bool parse_cpu_list(const char *str, cpu_set_t *set)
 {
-	union __union_tile_config cfg;
-	struct __tile *ptr_tile1, *ptr_tile2, *ptr_tile3, *ptr_tile4;
-	cpu_set_t mask;
+	int32_t first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*str) {
+		first = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return false;
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first)
+				return false;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str && *str != '\n')
+			return false;
+		else
+			break;
+	}
 
-	bool rtn = true;
-	uint32_t i = 0;
-	uint32_t thread_idx = *((uint32_t *)arg);
+	return CPU_COUNT(set) > 0;
+}
 
-	/* All sub threads are attached on CPU 1 */
-	CPU_ZERO(&mask);
-	CPU_SET(1, &mask);
-	pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+/*
+ * read_cpu_list() - Read a CPU list from sysfs.
+ * @path: The sysfs file.
+ * @set: The CPU set to fill.
+ *
+ * Return:
+ * true - OK
+ * false - The file does not exist or can not be parsed
+ */
+static bool read_cpu_list(const char *path, cpu_set_t *set)
+{
+	char buf[4096];
+	FILE *fp = fopen(path, "r");
+	bool rtn = false;
 
-	ptr_tile1 = &buf_tile1[thread_idx];
-	ptr_tile2 = &buf_tile2[thread_idx];
-	ptr_tile3 = &buf_tile3[thread_idx];
-	ptr_tile4 = &buf_tile4[thread_idx];
+	if (!fp)
+		return false;
 
-	/* Init the test data in memory */
-	if (ins_type == INS_TDPBF16PS)
-		init_bf16_tile(ptr_tile1, ROW_NUM, COL_NUM);
-#ifdef FP16
-	else if (ins_type == INS_TDPFP16PS)
-		init_fp16_tile(ptr_tile1, ROW_NUM, COL_NUM);
-#endif
-	else
-		init_dword_tile(ptr_tile1, ROW_NUM, COL_NUM);
+	if (fgets(buf, sizeof(buf), fp))
+		rtn = parse_cpu_list(buf, set);
+	fclose(fp);
 
-	memcpy(ptr_tile2, ptr_tile1, sizeof(struct __tile));
-	memcpy(ptr_tile3, ptr_tile1, sizeof(struct __tile));
-	memcpy(ptr_tile4, ptr_tile1, sizeof(struct __tile));
+	return rtn;
+}
 
-	/* Calculate a result by software and store it in memory */
-	if (ins_type == INS_TDPBF16PS) {
-		calc_matrix_tdpbf16ps(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpbf16ps(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpbf16ps(ptr_tile2, ptr_tile3, ptr_tile4);
-#ifdef FP16
-	} else if (ins_type == INS_TDPFP16PS) {
-		calc_matrix_tdpfp16ps(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpfp16ps(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpfp16ps(ptr_tile2, ptr_tile3, ptr_tile4);
-#endif
-	} else if (ins_type == INS_TDPBSSD) {
-		calc_matrix_tdpbssd(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpbssd(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpbssd(ptr_tile2, ptr_tile3, ptr_tile4);
-	} else if (ins_type == INS_TDPBSUD) {
-		calc_matrix_tdpbsud(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpbsud(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpbsud(ptr_tile2, ptr_tile3, ptr_tile4);
-	} else if (ins_type == INS_TDPBUSD) {
-		calc_matrix_tdpbusd(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpbusd(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpbusd(ptr_tile2, ptr_tile3, ptr_tile4);
-	} else if (ins_type == INS_TDPBUUD) {
-		calc_matrix_tdpbuud(ptr_tile4, ptr_tile3, ptr_tile2);
-		calc_matrix_tdpbuud(ptr_tile3, ptr_tile4, ptr_tile4);
-		calc_matrix_tdpbuud(ptr_tile2, ptr_tile3, ptr_tile4);
-	}
+/*
+ * nth_cpu() - Find the n-th CPU of a set, wrapping around.
+ * @set: The CPU set.
+ * @n: The index.
+ */
+static int32_t nth_cpu(cpu_set_t *set, int32_t n)
+{
+	int32_t cpu, count = CPU_COUNT(set);
 
-	/* Program the tile config to TILECFG register */
-	init_tile_config(&cfg, ROW_NUM, COL_NUM);
+	n %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, set) && n-- == 0)
+			break;
 
-	for (i = 0; i < cycles; i++) {
-		/* Step1: Program the test data to TMM register */
-		load_tile_reg(0, ptr_tile1, COL_NUM);
-		load_tile_reg(1, ptr_tile1, COL_NUM);
-		load_tile_reg(2, ptr_tile1, COL_NUM);
-		load_tile_reg(3, ptr_tile1, COL_NUM);
-		asm volatile("mfence" : : : "memory");
-
-		/* Step2: Interrupt this thread by a reason */
-		thread_break(break_reason, thread_idx);
-
-		load_tile_reg(4, ptr_tile1, COL_NUM);
-		load_tile_reg(5, ptr_tile1, COL_NUM);
-		load_tile_reg(6, ptr_tile1, COL_NUM);
-		load_tile_reg(7, ptr_tile1, COL_NUM);
-		asm volatile("mfence" : : : "memory");
-
-		/* Step3: Interrupt this thread by a reason */
-		thread_break(break_reason, thread_idx);
-
-		/* Step4: Calculate a result by TMUL and store it in TMM0 register */
-		if (ins_type == INS_TDPBF16PS)
-			tile_dpbf16ps();
-#ifdef FP16
-		else if (ins_type == INS_TDPFP16PS)
-			tile_dpfp16ps();
-#endif
-		else if (ins_type == INS_TDPBSSD)
-			tile_dpbssd();
-		else if (ins_type == INS_TDPBSUD)
-			tile_dpbsud();
-		else if (ins_type == INS_TDPBUSD)
-			tile_dpbusd();
-		else if (ins_type == INS_TDPBUUD)
-			tile_dpbuud();
-		asm volatile("mfence" : : : "memory");
-
-		/* Step5: Interrupt this thread by a reason */
-		thread_break(break_reason, thread_idx);
-
-		/* Step6: Store the result from TMM0 to memory */
-		store_tile_reg(0, ptr_tile3, COL_NUM);
-		asm volatile("mfence" : : : "memory");
-
-		/* Step7: Check if the 2 results are identical */
-		if (ins_type == INS_TDPBF16PS) {
-			if (!check_tile_bf16_register(ptr_tile3, ptr_tile2)) {
-				printf("Instruction %d test in Thread %d Cycle %d: failed\n",
-				       ins_type, thread_idx, i);
-				rtn = false;
-			}
-#ifdef FP16
-		} else if (ins_type == INS_TDPFP16PS) {
-			if (!check_tile_fp16_register(ptr_tile3, ptr_tile2)) {
-				printf("Instruction %d test in Thread %d Cycle %d: failed\n",
-				       ins_type, thread_idx, i);
-				rtn = false;
-			}
-#endif
-		} else {
-			if (!check_tile_dword_register(ptr_tile3, ptr_tile2)) {
-				printf("Instruction %d test in Thread %d Cycle %d: failed\n",
-				       ins_type, thread_idx, i);
-				rtn = false;
-			}
+	return cpu;
+}
+
+/*
+ * build_thread_masks() - Decide where every sub-thread runs.
+ *
+ * one CPU: all sub-threads share one CPU, to stress XSAVE/XRSTOR on switches
+ * core: one sub-thread per physical core, round-robin once cores run out
+ * list: round-robin over the given CPUs
+ * numa: sub-thread i may run on any CPU of the i-th node, round-robin
+ * Only CPUs this process is allowed to use are considered.
+ *
+ * Return:
+ * true - OK
+ * false - No usable CPU
+ */
+static bool build_thread_masks(void)
+{
+	cpu_set_t allowed, cpus, node_cpus[CPU_SETSIZE / 8];
+	char path[128];
+	int32_t i, cpu, node, nodes = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return false;
+
+	CPU_ZERO(&cpus);
+	switch (placement) {
+	case PLACE_ONE_CPU:
+		CPU_SET(place_cpu, &cpus);
+		break;
+	case PLACE_PER_CORE:
+		/* the first thread sibling stands for its core */
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			cpu_set_t siblings;
+
+			if (!CPU_ISSET(cpu, &allowed))
+				continue;
+			snprintf(path, sizeof(path),
+				 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+			if (!read_cpu_list(path, &siblings) || nth_cpu(&siblings, 0) == cpu)
+				CPU_SET(cpu, &cpus);
 		}
+		break;
+	case PLACE_CPU_LIST:
+		CPU_AND(&cpus, &place_list, &allowed);
+		break;
+	case PLACE_PER_NODE:
+		for (node = 0; node < CPU_SETSIZE / 8; node++) {
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+			if (!read_cpu_list(path, &node_cpus[nodes]))
+				continue;
+			CPU_AND(&node_cpus[nodes], &node_cpus[nodes], &allowed);
+			if (CPU_COUNT(&node_cpus[nodes]))
+				nodes++;
+		}
+		if (!nodes) {
+			node_cpus[0] = allowed;
+			nodes = 1;
+		}
+		for (i = 0; i < thread_num; i++)
+			thread_mask[i] = node_cpus[i % nodes];
+		return true;
 	}
 
-	/* After every sub-thread is done, the main thread can exit */
-	thread_done[thread_idx] = true;
+	if (!CPU_COUNT(&cpus)) {
+		printf("No allowed CPU to place sub-threads on\n");
+		return false;
+	}
 
-	if (rtn)
-		pthread_exit((void *)0);
-	else
-		pthread_exit((void *)1);
+	for (i = 0; i < thread_num; i++) {
+		CPU_ZERO(&thread_mask[i]);
+		CPU_SET(nth_cpu(&cpus, i), &thread_mask[i]);
+	}
+
+	return true;
 }
 
-static struct option long_options[] = {
-	{"break-reason", required_argument, 0, 'b'},
-	{"thread-count", required_argument, 0, 't'},
-	{"cycle-number", required_argument, 0, 'c'},
-	{"instruction-type", required_argument, 0, 'i'},
-	{"help", no_argument, 0, 'h'},
-	{0, 0, 0, 0}
-};
+static double now_sec(void)
+{
+	struct timespec ts;
 
-static const char *option_string = "b:t:c:i:h::";
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-static char *progname;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-static void help(void)
+/*
+ * init_test_data() - Init the test data in memory.
+ * @type: The instruction type.
+ * @tile1: Input of the TMUL calculation, a full tile that every
+ *         register loads its rows x colsb from.
+ */
+static void init_test_data(int32_t type, struct __tile *tile1)
 {
-	fprintf(stderr,
-		"Usage: %s [OPTIONS]\n"
-		"%s runs amx_tmul test\n"
-		"  -b, --break-reason [%d - %d]\n"
-		"      0: break by nothing\n"
-		"      1: break by yield\n"
-		"      2: break by sleep\n"
-		"      3: break by trap\n"
-		"      4: break by signal\n"
-		"      5: break by futex\n"
-		"  -t, --thread-count [Should not be less than %d]\n"
-		"  -c, --cycle-number [Should not be less than 1]\n"
+	if (type == INS_TDPBF16PS)
+		init_bf16_tile(tile1, ROW_NUM, COL_NUM);
 #ifdef FP16
-		"  -i, --instruction-type [0:TDPBF16PS 1:TDPBSSD 2:TDPBSUD 3:TDPBUSD 4:TDPBUUD 5:TDPFP16PS]\n"
-#else
-		"  -i, --instruction-type [0:TDPBF16PS 1:TDPBSSD 2:TDPBSUD 3:TDPBUSD 4:TDPBUUD]\n"
+	else if (type == INS_TDPFP16PS)
+		init_fp16_tile(tile1, ROW_NUM, COL_NUM);
 #endif
-		, progname, progname, BREAK_BY_YIELD, BREAK_REASON_MAX, MIN_THREAD_NUM);
+	else
+		init_dword_tile(tile1, ROW_NUM, COL_NUM);
 }
 
 /*
- * parse_options() - The main process entrance.
- * @ac: The total number of arguments.
- * @av: Pointer array.
+ * TMUL instructions as (dst, src1, src2) tile registers.
+ * The test chain feeds results into later instructions, the benchmark
+ * block has four independent accumulators TMM0-3.
+ */
+static const int32_t test_chain[4][3] = { {5, 6, 7}, {2, 3, 4}, {1, 2, 5}, {0, 1, 2} };
+static const int32_t bench_block[4][3] = { {0, 4, 6}, {1, 4, 7}, {2, 5, 6}, {3, 5, 7} };
+
+/*
+ * check_shape() - Check if tile shapes fit a sequence of TMUL instructions.
+ * @shape: The tile shapes.
+ * @seq: The instructions.
+ *
+ * dst is M x 4N, src1 M x 4K and src2 K x 4N, otherwise TMUL raises #UD.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool check_shape(const struct tile_shape *shape, const int32_t seq[4][3])
+{
+	int32_t i, d, a, b;
+
+	for (i = 0; i < 4; i++) {
+		d = seq[i][0];
+		a = seq[i][1];
+		b = seq[i][2];
+		if (shape->rows[a] != shape->rows[d] || shape->colsb[b] != shape->colsb[d] ||
+		    shape->colsb[a] / 4 != shape->rows[b]) {
+			printf("tmm%d (%dx%d) += tmm%d (%dx%d) * tmm%d (%dx%d): shapes do not fit\n",
+			       d, shape->rows[d], shape->colsb[d], a, shape->rows[a],
+			       shape->colsb[a], b, shape->rows[b], shape->colsb[b]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * calc_sequence() - Software algorithm for a sequence of TMUL instructions.
+ * @type: The instruction type.
+ * @shape: The tile shapes.
+ * @seq: The instructions.
+ * @tile1: Every register is loaded from here with stride COL_NUM.
+ * @reg: The 8 tile registers after the sequence, packed rows.
+ */
+static void calc_sequence(int32_t type, const struct tile_shape *shape,
+			  const int32_t seq[4][3], struct __tile *tile1, struct __tile *reg)
+{
+	int32_t i, r;
+
+	for (i = 0; i < 8; i++) {
+		reg[i].rows = shape->rows[i];
+		reg[i].colsb = shape->colsb[i];
+		for (r = 0; r < shape->rows[i]; r++)
+			memcpy(reg[i].buf + r * shape->colsb[i], tile1->buf + r * COL_NUM,
+			       shape->colsb[i]);
+	}
+
+	for (i = 0; i < 4; i++)
+		calc_matrix(type, &reg[seq[i][0]], &reg[seq[i][1]], &reg[seq[i][2]]);
+}
+
+/*
+ * tile_dp() - Calculate a result by TMUL and store it in TMM0 register.
+ * @type: The instruction type.
+ */
+static void tile_dp(int32_t type)
+{
+	if (type == INS_TDPBF16PS)
+		tile_dpbf16ps();
+#ifdef FP16
+	else if (type == INS_TDPFP16PS)
+		tile_dpfp16ps();
+#endif
+	else if (type == INS_TDPBSSD)
+		tile_dpbssd();
+	else if (type == INS_TDPBSUD)
+		tile_dpbsud();
+	else if (type == INS_TDPBUSD)
+		tile_dpbusd();
+	else if (type == INS_TDPBUUD)
+		tile_dpbuud();
+}
+
+/*
+ * check_result() - Check if the 2 results are identical.
+ * @type: The instruction type.
+ * @ref: The result calculated by AMX/TMUL.
+ * @target: The result calculated by software.
+ */
+static bool check_result(int32_t type, struct __tile *ref, struct __tile *target)
+{
+	if (type == INS_TDPBF16PS)
+		return check_tile_bf16_register(ref, target);
+#ifdef FP16
+	if (type == INS_TDPFP16PS)
+		return check_tile_fp16_register(ref, target);
+#endif
+	return check_tile_dword_register(ref, target);
+}
+
+static void load_all_tile_reg(struct __tile *tile)
+{
+	load_tile_reg(0, tile, COL_NUM);
+	load_tile_reg(1, tile, COL_NUM);
+	load_tile_reg(2, tile, COL_NUM);
+	load_tile_reg(3, tile, COL_NUM);
+	load_tile_reg(4, tile, COL_NUM);
+	load_tile_reg(5, tile, COL_NUM);
+	load_tile_reg(6, tile, COL_NUM);
+	load_tile_reg(7, tile, COL_NUM);
+}
+
+/*
+ * test_cycle() - Run one interrupted TMUL calculation and check it.
+ * @type: The instruction type.
+ * @thread_idx: The index of sub-thread.
+ * @tile1: Input of the TMUL calculation.
+ * @ref: Result calculated by software.
+ * @tile3: Result calculated by TMUL, packed rows of TMM0.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool test_cycle(int32_t type, uint32_t thread_idx, struct __tile *tile1,
+		       struct __tile *ref, struct __tile *tile3)
+{
+	/* Step1: Program the test data to TMM register */
+	load_tile_reg(0, tile1, COL_NUM);
+	load_tile_reg(1, tile1, COL_NUM);
+	load_tile_reg(2, tile1, COL_NUM);
+	load_tile_reg(3, tile1, COL_NUM);
+	asm volatile("mfence" : : : "memory");
+
+	/* Step2: Interrupt this thread by a reason */
+	thread_break(break_reason, thread_idx);
+
+	load_tile_reg(4, tile1, COL_NUM);
+	load_tile_reg(5, tile1, COL_NUM);
+	load_tile_reg(6, tile1, COL_NUM);
+	load_tile_reg(7, tile1, COL_NUM);
+	asm volatile("mfence" : : : "memory");
+
+	/* Step3: Interrupt this thread by a reason */
+	thread_break(break_reason, thread_idx);
+
+	/* Step4: Calculate a result by TMUL and store it in TMM0 register */
+	tile_dp(type);
+	asm volatile("mfence" : : : "memory");
+
+	/* Step5: Interrupt this thread by a reason */
+	thread_break(break_reason, thread_idx);
+
+	/* Step6: Store the result from TMM0 to memory */
+	store_tile_reg(0, tile3, ref->colsb);
+	asm volatile("mfence" : : : "memory");
+
+	/* Step7: Check if the 2 results are identical */
+	return check_result(type, tile3, ref);
+}
+
+/*
+ * TILE_DP_BLOCK() - Four independent TMUL instructions, see bench_block.
+ * Accumulate into TMM0-3 from TMM4-5 x TMM6-7, so that no instruction
+ * waits for the result of the previous one.
+ */
+#define TILE_DP_BLOCK(ins)				\
+	asm volatile(ins " %tmm6, %tmm4, %tmm0\n\t"	\
+		     ins " %tmm7, %tmm4, %tmm1\n\t"	\
+		     ins " %tmm6, %tmm5, %tmm2\n\t"	\
+		     ins " %tmm7, %tmm5, %tmm3")
+
+#define TILE_DP_PER_BLOCK 4
+
+static void tile_dp_block(int32_t type)
+{
+	if (type == INS_TDPBF16PS)
+		TILE_DP_BLOCK("tdpbf16ps");
+#ifdef FP16
+	else if (type == INS_TDPFP16PS)
+		TILE_DP_BLOCK("tdpfp16ps");
+#endif
+	else if (type == INS_TDPBSSD)
+		TILE_DP_BLOCK("tdpbssd");
+	else if (type == INS_TDPBSUD)
+		TILE_DP_BLOCK("tdpbsud");
+	else if (type == INS_TDPBUSD)
+		TILE_DP_BLOCK("tdpbusd");
+	else if (type == INS_TDPBUUD)
+		TILE_DP_BLOCK("tdpbuud");
+}
+
+/*
+ * test_block() - Run one interrupted benchmark block and check TMM0-3.
+ * @type: The instruction type.
+ * @thread_idx: The index of sub-thread.
+ * @tile1: Input of the TMUL calculation.
+ * @ref: Registers calculated by software.
+ * @tile3: Scratch for the results calculated by TMUL.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool test_block(int32_t type, uint32_t thread_idx, struct __tile *tile1,
+		       struct __tile *ref, struct __tile *tile3)
+{
+	bool rtn = true;
+
+	load_all_tile_reg(tile1);
+	thread_break(break_reason, thread_idx);
+	tile_dp_block(type);
+
+	store_tile_reg(0, tile3, ref[0].colsb);
+	rtn &= check_result(type, tile3, &ref[0]);
+	store_tile_reg(1, tile3, ref[1].colsb);
+	rtn &= check_result(type, tile3, &ref[1]);
+	store_tile_reg(2, tile3, ref[2].colsb);
+	rtn &= check_result(type, tile3, &ref[2]);
+	store_tile_reg(3, tile3, ref[3].colsb);
+	rtn &= check_result(type, tile3, &ref[3]);
+
+	return rtn;
+}
+
+/*
+ * tile_dp_ops() - Multiplies plus adds done by one benchmark TMUL instruction.
+ * @type: The instruction type.
+ * @shape: The tile shapes.
+ *
+ * M x N dword results, each a dot-product of K dword sized groups
+ * of 2 (BF16, FP16) or 4 (INT8) element pairs.
+ */
+static uint64_t tile_dp_ops(int32_t type, const struct tile_shape *shape)
+{
+	uint64_t pairs_per_dword = 4;
+
+	if (type == INS_TDPBF16PS)
+		pairs_per_dword = 2;
+#ifdef FP16
+	if (type == INS_TDPFP16PS)
+		pairs_per_dword = 2;
+#endif
+
+	return 2ULL * shape->rows[0] * (shape->colsb[0] / 4) * (shape->colsb[4] / 4) *
+	       pairs_per_dword;
+}
+
+static const char *ins_name[] = {
+	"TDPBF16PS", "TDPBSSD", "TDPBSUD", "TDPBUSD", "TDPBUUD",
+#ifdef FP16
+	"TDPFP16PS",
+#endif
+};
+
+static double *bench_slot(int32_t shape_idx, int32_t type, int32_t thread_idx)
+{
+	return &bench_sec[(shape_idx * (INS_MAX_NUM + 1) + type) * thread_num + thread_idx];
+}
+
+/*
+ * compare_calc_isa() - Check the vector reference kernels against scalar.
+ *
+ * Every instruction type, on random bytes for both sources and the
+ * accumulator, with every vector ISA the CPU supports. The results must
+ * be bit identical, except that any NaN matches any NaN, see the comment
+ * above the vector kernels.
+ *
+ * Return:
+ * true - OK
+ * false - Mismatch
+ */
+static bool compare_calc_isa(void)
+{
+	static struct __tile src1, src2, ref, dst;
+	uint32_t *rbuf = (uint32_t *)ref.buf, *dbuf = (uint32_t *)dst.buf;
+	int32_t isa, type, round;
+	uint32_t i, mismatch;
+	bool rtn = true, fp;
+
+	src1.rows = src2.rows = ref.rows = dst.rows = ROW_NUM;
+	src1.colsb = src2.colsb = ref.colsb = dst.colsb = COL_NUM;
+
+	for (isa = CALC_AVX2; isa <= CALC_AVX512; isa++) {
+		if (isa == CALC_AVX512 ? !__builtin_cpu_supports("avx512f") :
+		    !__builtin_cpu_supports("avx2")) {
+			printf("Compare %s reference kernels: skipped, not supported by this CPU\n",
+			       calc_isa_name[isa]);
+			continue;
+		}
+		for (type = INS_TDPBF16PS; type <= INS_MAX_NUM; type++) {
+			fp = type == INS_TDPBF16PS;
+#ifdef FP16
+			fp |= type == INS_TDPFP16PS;
+#endif
+			mismatch = 0;
+			for (round = 0; round < COMPARE_ROUNDS; round++) {
+				get_random((uint32_t *)src1.buf, sizeof(src1.buf) / 4);
+				get_random((uint32_t *)src2.buf, sizeof(src2.buf) / 4);
+				get_random(rbuf, sizeof(ref.buf) / 4);
+				memcpy(dst.buf, ref.buf, sizeof(ref.buf));
+
+				calc_isa = CALC_SCALAR;
+				calc_matrix(type, &ref, &src1, &src2);
+				calc_isa = isa;
+				calc_matrix(type, &dst, &src1, &src2);
+
+				for (i = 0; i < sizeof(ref.buf) / 4; i++)
+					if (rbuf[i] != dbuf[i] &&
+					    !(fp && isnan(((float *)rbuf)[i]) &&
+					      isnan(((float *)dbuf)[i])))
+						mismatch++;
+			}
+			printf("Compare %s reference kernels, %s: %u mismatches in %d rounds\n",
+			       calc_isa_name[isa], ins_name[type], mismatch, COMPARE_ROUNDS);
+			if (mismatch)
+				rtn = false;
+		}
+	}
+	calc_isa = CALC_COMPARE;
+
+	return rtn;
+}
+
+/*
+ * detect_amx_fp16() - Check CPUID.(EAX=7,ECX=1):EAX[21] for AMX-FP16.
+ */
+static bool detect_amx_fp16(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return eax & (1U << 21);
+}
+
+/*
+ * type_supported() - Whether the CPU runs the instruction type.
+ * @type: The instruction type.
+ *
+ * Only TDPFP16PS needs more than AMX-INT8/AMX-BF16, see detect_amx_fp16().
+ */
+static bool type_supported(int32_t type)
+{
+#ifdef FP16
+	if (type == INS_TDPFP16PS)
+		return amx_fp16;
+#else
+	(void)type;
+#endif
+	return true;
+}
+
+/*
+ * bench_type() - Run TMUL instructions back-to-back for throughput.
+ * @type: The instruction type.
+ * @shape_idx: Index of the tile shapes, in sweep_shapes in sweep mode.
+ * @thread_idx: The index of sub-thread.
+ * @tile1: Input of the TMUL calculation.
+ * @ref: Registers calculated by software for one block.
+ * @tile3: Scratch for the results calculated by TMUL.
+ *
+ * Every verify_interval cycles, break the thread and run one checked
+ * block from freshly loaded registers.
+ * The checks are part of the timed section, so keep them rare.
+ * The last sub-thread through the barrier stamps the common start in
+ * bench_start, every sub-thread stamps its own end in bench_sec.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool bench_type(int32_t type, int32_t shape_idx, uint32_t thread_idx,
+		       struct __tile *tile1, struct __tile *ref, struct __tile *tile3)
+{
+	bool rtn = true;
+	uint32_t i;
+
+	if (pthread_barrier_wait(&bench_barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+		bench_start[shape_idx * (INS_MAX_NUM + 1) + type] = now_sec();
+
+	load_all_tile_reg(tile1);
+
+	for (i = 0; i < cycles; i++) {
+		tile_dp_block(type);
+
+		if ((i + 1) % verify_interval && i + 1 != cycles)
+			continue;
+
+		if (!test_block(type, thread_idx, tile1, ref, tile3)) {
+			printf("Instruction %d bench in Thread %d Cycle %d: failed\n",
+			       type, thread_idx, i);
+			rtn = false;
+		}
+	}
+
+	*bench_slot(shape_idx, type, thread_idx) = now_sec();
+
+	return rtn;
+}
+
+static const char *break_name[] = {
+	"nothing", "yield", "sleep", "trap", "signal", "futex",
+};
+
+static const char *lat_state_name[] = {
+	"init", "tiledata", "released",
+};
+
+/*
+ * rdtsc_ordered() - Read TSC after all earlier instructions are done.
+ */
+static inline uint64_t rdtsc_ordered(void)
+{
+	_mm_lfence();
+	return __rdtsc();
+}
+
+/*
+ * latency_break() - Break the thread execution without help of main().
+ * @reason: Several kinds of reason to break the thread execution.
+ * @thread_idx: The index of sub-thread.
+ *
+ * Same as thread_break(), except that sleep lasts 1us, the thread sends
+ * SIGUSR1 to itself and the futex wait times out after 1us, so that
+ * every break switches out and back without waiting on the main thread.
+ */
+static void latency_break(int32_t reason, uint32_t thread_idx)
+{
+	struct timespec req = { 0, 1000 };
+
+	switch (reason) {
+	case BREAK_BY_SLEEP:
+		do_syscall(SYS_nanosleep, (uint64_t)&req, 0, 0, 0, 0, 0);
+		break;
+	case BREAK_BY_SIGNAL:
+		pthread_kill(pthread_self(), SIGUSR1);
+		break;
+	case BREAK_BY_FUTEX:
+		do_syscall(SYS_futex, (uint64_t)&futex_ptr[thread_idx],
+			   FUTEX_WAIT, FUTEX_VAL, (uint64_t)&req, 0, 0);
+		break;
+	default:
+		thread_break(reason, thread_idx);
+		break;
+	}
+}
+
+static struct break_latency *lat_slot(uint32_t thread_idx, int32_t state, int32_t reason)
+{
+	return &break_lat[(thread_idx * LAT_STATE_NUM + state) * (BREAK_REASON_MAX + 1) +
+			  reason];
+}
+
+/*
+ * measure_breaks() - Time every break reason in the current tile state.
+ * @thread_idx: The index of sub-thread.
+ * @state: Whether tile data is in use, see ENUM_LATENCY_STATE.
+ */
+static void measure_breaks(uint32_t thread_idx, int32_t state)
+{
+	struct break_latency *lat;
+	uint64_t start, delta;
+	int32_t reason, bucket;
+	uint32_t i;
+
+	for (reason = BREAK_BY_NOTHING; reason <= BREAK_REASON_MAX; reason++) {
+		lat = lat_slot(thread_idx, state, reason);
+		lat->min = UINT64_MAX;
+		for (i = 0; i < cycles; i++) {
+			start = rdtsc_ordered();
+			latency_break(reason, thread_idx);
+			delta = rdtsc_ordered() - start;
+
+			bucket = delta ? 63 - __builtin_clzll(delta) : 0;
+			if (bucket >= LAT_HIST_BUCKETS)
+				bucket = LAT_HIST_BUCKETS - 1;
+			lat->hist[bucket]++;
+			lat->count++;
+			lat->sum += delta;
+			if (delta < lat->min)
+				lat->min = delta;
+			if (delta > lat->max)
+				lat->max = delta;
+		}
+	}
+}
+
+/*
+ * measure_latency() - Time every break reason with and without tile data.
+ * @thread_idx: The index of sub-thread.
+ * @tile1: Data loaded to the tile registers.
+ * @tile3: Scratch to store a tile register back.
+ *
+ * First before this thread touches AMX, then with all 8 tile registers
+ * loaded, then after TILERELEASE has put the tile state back to its init
+ * state. The loaded tiles are checked to survive the breaks.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool measure_latency(uint32_t thread_idx, struct __tile *tile1, struct __tile *tile3)
+{
+	union __union_tile_config cfg;
+	int32_t r;
+
+	measure_breaks(thread_idx, LAT_TILE_INIT);
+
+	init_test_data(INS_TDPBSSD, tile1);
+	init_tile_config(&cfg, &tile_shape);
+	load_all_tile_reg(tile1);
+	measure_breaks(thread_idx, LAT_TILE_DATA);
+
+	store_tile_reg(7, tile3, COL_NUM);
+	for (r = 0; r < tile_shape.rows[7]; r++)
+		if (memcmp(tile3->buf + r * COL_NUM, tile1->buf + r * COL_NUM,
+			   tile_shape.colsb[7])) {
+			printf("Thread %d: TMM7 corrupted by breaks\n", thread_idx);
+			return false;
+		}
+
+	asm volatile("tilerelease" ::: "memory");
+	measure_breaks(thread_idx, LAT_TILE_RELEASED);
+
+	return true;
+}
+
+/*
+ * worker_thread() - The sub-thread entrance.
+ * @arg: The index of sub-thread.
+ *       Index from 0 to the total number of threads - 1.
+ *
+ * Two results are generated by AMX/TMUL calculation procedure,
+ * one is calculated by software, the other is calculated by TMUL.
+ * Interrupt the AMX/TMUL calculation procedure by different reasons.
+ * These reasons may cause context-switch by Kernel.
+ * Check if the thread context is saved and restored correctly
+ * by comparing the two results.
+ * In benchmark mode, time the TMUL instructions of every selected type
+ * and, in sweep mode, of every tile shape.
+ */
+static void *worker_thread(void *arg)
+{
+	union __union_tile_config cfg;
+	struct __tile *ptr_tile1, *ptr_tile2, *ptr_tile3;
+	struct __tile reg[8];
+	struct tile_shape *shape;
+	double start_sec;
+	int32_t type, shape_idx;
+
+	bool rtn = true;
+	uint32_t i = 0;
+	uint32_t thread_idx = *((uint32_t *)arg);
+
+	/* Attach to the CPUs chosen by -p, CPU 1 by default */
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread_mask[thread_idx]);
+	start_sec = now_sec();
+
+	ptr_tile1 = &buf_tile1[thread_idx];
+	ptr_tile2 = &buf_tile2[thread_idx];
+	ptr_tile3 = &buf_tile3[thread_idx];
+
+	if (latency_mode) {
+		rtn = measure_latency(thread_idx, ptr_tile1, ptr_tile3);
+		i = cycles * LAT_STATE_NUM * (BREAK_REASON_MAX + 1);
+		goto done;
+	}
+
+	if (bench_mode) {
+		for (shape_idx = 0; shape_idx < shape_num; shape_idx++) {
+			shape = sweep_mode ? &sweep_shapes[shape_idx] : &tile_shape;
+			init_tile_config(&cfg, shape);
+			for (type = INS_TDPBF16PS; type <= INS_MAX_NUM; type++) {
+				if ((!bench_all && type != ins_type) || !type_supported(type))
+					continue;
+				init_test_data(type, ptr_tile1);
+				calc_sequence(type, shape, bench_block, ptr_tile1, reg);
+				if (!bench_type(type, shape_idx, thread_idx, ptr_tile1, reg,
+						ptr_tile3))
+					rtn = false;
+				i += cycles;
+			}
+		}
+		goto done;
+	}
+
+	/* Init the test data and calculate a result by software */
+	init_test_data(ins_type, ptr_tile1);
+	calc_sequence(ins_type, &tile_shape, test_chain, ptr_tile1, reg);
+	memcpy(ptr_tile2, &reg[0], sizeof(struct __tile));
+
+	/* Program the tile config to TILECFG register */
+	init_tile_config(&cfg, &tile_shape);
+
+	for (i = 0; i < cycles; i++) {
+		if (!test_cycle(ins_type, thread_idx, ptr_tile1, ptr_tile2, ptr_tile3)) {
+			printf("Instruction %d test in Thread %d Cycle %d: failed\n",
+			       ins_type, thread_idx, i);
+			rtn = false;
+		}
+	}
+
+done:
+	thread_report[thread_idx].done_cycles = i;
+	thread_report[thread_idx].cpu = sched_getcpu();
+	thread_report[thread_idx].wall_sec = now_sec() - start_sec;
+
+	/* After every sub-thread is done, the main thread can exit */
+	thread_done[thread_idx] = true;
+
+	if (rtn)
+		pthread_exit((void *)0);
+	else
+		pthread_exit((void *)1);
+}
+
+/*
+ * print_latency() - Print the break latency of every sub-thread.
+ *
+ * Min, average and max TSC cycles of each break reason in each tile
+ * state, followed by the non-empty log2 buckets. The average penalty of
+ * live tile data over the init state is summed up for all sub-threads.
+ */
+static void print_latency(void)
+{
+	struct break_latency *lat;
+	uint64_t sum[LAT_STATE_NUM], count[LAT_STATE_NUM];
+	int32_t reason, state, i, n;
+
+	for (i = 0; i < thread_num; i++) {
+		for (reason = BREAK_BY_NOTHING; reason <= BREAK_REASON_MAX; reason++) {
+			for (state = LAT_TILE_INIT; state < LAT_STATE_NUM; state++) {
+				lat = lat_slot(i, state, reason);
+				if (!lat->count)
+					continue;
+				printf("Thread %d %-7s %-8s: min %lu avg %lu max %lu cycles |", i,
+				       break_name[reason], lat_state_name[state], lat->min,
+				       lat->sum / lat->count, lat->max);
+				for (n = 0; n < LAT_HIST_BUCKETS; n++)
+					if (lat->hist[n])
+						printf(" 2^%d:%lu", n, lat->hist[n]);
+				printf("\n");
+			}
+		}
+	}
+
+	for (reason = BREAK_BY_NOTHING; reason <= BREAK_REASON_MAX; reason++) {
+		for (state = LAT_TILE_INIT; state < LAT_STATE_NUM; state++) {
+			sum[state] = 0;
+			count[state] = 0;
+			for (i = 0; i < thread_num; i++) {
+				lat = lat_slot(i, state, reason);
+				sum[state] += lat->sum;
+				count[state] += lat->count;
+			}
+			if (!count[state])
+				count[state] = 1;
+		}
+		printf("%-7s avg: init %lu, tiledata %lu (%+ld), released %lu (%+ld) cycles\n",
+		       break_name[reason], sum[LAT_TILE_INIT] / count[LAT_TILE_INIT],
+		       sum[LAT_TILE_DATA] / count[LAT_TILE_DATA],
+		       (int64_t)(sum[LAT_TILE_DATA] / count[LAT_TILE_DATA]) -
+		       (int64_t)(sum[LAT_TILE_INIT] / count[LAT_TILE_INIT]),
+		       sum[LAT_TILE_RELEASED] / count[LAT_TILE_RELEASED],
+		       (int64_t)(sum[LAT_TILE_RELEASED] / count[LAT_TILE_RELEASED]) -
+		       (int64_t)(sum[LAT_TILE_INIT] / count[LAT_TILE_INIT]));
+	}
+}
+
+/*
+ * live_tile_bytes() - Bytes of tile data the shapes actually use.
+ * @shape: The tile shapes.
+ *
+ * XSAVE still saves the whole 8KB XTILEDATA component, this is what
+ * a kernel with these shapes needs resident.
+ */
+static int32_t live_tile_bytes(const struct tile_shape *shape)
+{
+	int32_t i, bytes = 0;
+
+	for (i = 0; i < 8; i++)
+		bytes += shape->rows[i] * shape->colsb[i];
+
+	return bytes;
+}
+
+/*
+ * print_bench() - Print the throughput of every benchmarked type and shape.
+ *
+ * All tile-ops of all sub-threads over the time from the common start
+ * to the last sub-thread done, so sub-threads sharing a CPU are not
+ * counted as if each had it to itself.
+ */
+static void print_bench(void)
+{
+	struct tile_shape *shape;
+	int32_t shape_idx, type, i;
+	double tdp_per_sec, end_sec;
+
+	for (shape_idx = 0; shape_idx < shape_num; shape_idx++) {
+		shape = sweep_mode ? &sweep_shapes[shape_idx] : &tile_shape;
+		for (type = INS_TDPBF16PS; type <= INS_MAX_NUM; type++) {
+			if (!bench_all && type != ins_type)
+				continue;
+			if (!type_supported(type)) {
+				printf("%s: skipped, not supported by this CPU\n", ins_name[type]);
+				continue;
+			}
+
+			end_sec = 0;
+			for (i = 0; i < thread_num; i++)
+				if (*bench_slot(shape_idx, type, i) > end_sec)
+					end_sec = *bench_slot(shape_idx, type, i);
+			end_sec -= bench_start[shape_idx * (INS_MAX_NUM + 1) + type];
+			tdp_per_sec = end_sec > 0 ? (double)cycles * TILE_DP_PER_BLOCK *
+				      thread_num / end_sec : 0;
+
+			printf("%s C %dx%d A %dx%d B %dx%d (%d tile bytes): %d threads, %.3f M tile-ops/s, %.3f TOPS\n",
+			       ins_name[type], shape->rows[0], shape->colsb[0],
+			       shape->rows[4], shape->colsb[4], shape->rows[6], shape->colsb[6],
+			       live_tile_bytes(shape), thread_num, tdp_per_sec / 1e6,
+			       tdp_per_sec * tile_dp_ops(type, shape) / 1e12);
+		}
+	}
+}
+
+/*
+ * set_block_shape() - Tile shapes of a benchmark block.
+ * @shape: The tile shapes to fill.
+ * @m: Rows of C and A.
+ * @n_colsb: Column number in byte of C and B.
+ * @k_colsb: Column number in byte of A, B has k_colsb / 4 rows.
+ */
+static void set_block_shape(struct tile_shape *shape, int32_t m, int32_t n_colsb,
+			    int32_t k_colsb)
+{
+	int32_t i;
+
+	for (i = 0; i < 4; i++) {
+		shape->rows[i] = m;
+		shape->colsb[i] = n_colsb;
+	}
+	for (i = 4; i < 6; i++) {
+		shape->rows[i] = m;
+		shape->colsb[i] = k_colsb;
+	}
+	for (i = 6; i < 8; i++) {
+		shape->rows[i] = k_colsb / 4;
+		shape->colsb[i] = n_colsb;
+	}
+}
+
+/*
+ * build_sweep_shapes() - Full, half and one row/column edge tiles.
+ *
+ * Every combination of M, N and K from full tiles down to the
+ * single row/column left over at the edges of a matrix.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool build_sweep_shapes(void)
+{
+	static const int32_t m_list[] = { ROW_NUM, ROW_NUM / 2, 1 };
+	static const int32_t colsb_list[] = { COL_NUM, COL_NUM / 2, 4 };
+	int32_t m, n, k, idx = 0;
+
+	shape_num = 3 * 3 * 3;
+	sweep_shapes = (struct tile_shape *)calloc(shape_num, sizeof(struct tile_shape));
+	if (!sweep_shapes)
+		return false;
+
+	for (m = 0; m < 3; m++)
+		for (n = 0; n < 3; n++)
+			for (k = 0; k < 3; k++)
+				set_block_shape(&sweep_shapes[idx++], m_list[m],
+						colsb_list[n], colsb_list[k]);
+
+	return true;
+}
+
+static struct option long_options[] = {
+	{"break-reason", required_argument, 0, 'b'},
+	{"thread-count", required_argument, 0, 't'},
+	{"cycle-number", required_argument, 0, 'c'},
+	{"instruction-type", required_argument, 0, 'i'},
+	{"placement", required_argument, 0, 'p'},
+	{"benchmark", no_argument, 0, 'B'},
+	{"verify-interval", required_argument, 0, 'v'},
+	{"reference", required_argument, 0, 'r'},
+	{"shape", required_argument, 0, 's'},
+	{"sweep", no_argument, 0, 'S'},
+	{"latency", no_argument, 0, 'l'},
+	{"help", no_argument, 0, 'h'},
+	{0, 0, 0, 0}
+};
+
+static const char *option_string = "b:t:c:i:p:Bv:r:s:Slh::";
+
+static char *progname;
+
+static void help(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"%s runs amx_tmul test\n"
+		"  -b, --break-reason [%d - %d]\n"
+		"      0: break by nothing\n"
+		"      1: break by yield\n"
+		"      2: break by sleep\n"
+		"      3: break by trap\n"
+		"      4: break by signal\n"
+		"      5: break by futex\n"
+		"  -t, --thread-count [Should not be less than %d]\n"
+		"  -c, --cycle-number [Should not be less than 1]\n"
+#ifdef FP16
+		"  -i, --instruction-type [0:TDPBF16PS 1:TDPBSSD 2:TDPBSUD 3:TDPBUSD 4:TDPBUUD 5:TDPFP16PS]\n"
+#else
+		"  -i, --instruction-type [0:TDPBF16PS 1:TDPBSSD 2:TDPBSUD 3:TDPBUSD 4:TDPBUUD]\n"
+#endif
+		"  -p, --placement [one[:CPU] | core | numa | <cpu-list>]\n"
+		"      one: all sub-threads on one CPU, CPU %d by default\n"
+		"      core: one sub-thread per physical core\n"
+		"      numa: sub-threads spread over NUMA nodes\n"
+		"      <cpu-list>: round-robin over CPUs such as 0-3,8\n"
+		"  -B, --benchmark, run TMUL back-to-back and report throughput,\n"
+		"      of every instruction type unless -i is given\n"
+		"  -v, --verify-interval [cycles between checks in benchmark mode, default 1000]\n"
+		"  -r, --reference [auto | scalar | avx2 | avx512 | compare] software result kernels,\n"
+		"      compare checks the vector kernels against scalar first\n"
+		"  -s, --shape [RxC | RxC,RxC,...] rows x column bytes of TMM0-7, default 16x64\n"
+		"      one RxC for every register, or 8 of them for TMM0 to TMM7\n"
+		"  -S, --sweep, with -B, benchmark full, half and edge tile shapes\n"
+		"  -l, --latency, time -c breaks of every reason before AMX is used,\n"
+		"      with tile data and after TILERELEASE, -b is ignored\n"
+		, progname, progname, BREAK_BY_YIELD, BREAK_REASON_MAX, MIN_THREAD_NUM,
+		DEFAULT_WORKER_CPU);
+}
+
+/*
+ * parse_placement() - Parse the argument of -p.
+ * @str: one[:CPU], core, numa or a CPU list.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool parse_placement(const char *str)
+{
+	if (strcmp(str, "one") == 0) {
+		placement = PLACE_ONE_CPU;
+	} else if (strncmp(str, "one:", 4) == 0) {
+		placement = PLACE_ONE_CPU;
+		place_cpu = atoi(str + 4);
+		if (place_cpu < 0 || place_cpu >= CPU_SETSIZE)
+			return false;
+	} else if (strcmp(str, "core") == 0) {
+		placement = PLACE_PER_CORE;
+	} else if (strcmp(str, "numa") == 0) {
+		placement = PLACE_PER_NODE;
+	} else {
+		placement = PLACE_CPU_LIST;
+		return parse_cpu_list(str, &place_list);
+	}
+
+	return true;
+}
+
+/*
+ * parse_shape() - Parse the argument of -s.
+ * @str: One RxC for all tile registers, or 8 comma separated RxC.
+ *
+ * Return:
+ * true - OK
+ * false - Abnormal
+ */
+static bool parse_shape(const char *str)
+{
+	int32_t i, rows, colsb, len;
+
+	for (i = 0; i < 8; i++) {
+		if (sscanf(str, "%dx%d%n", &rows, &colsb, &len) != 2 ||
+		    rows < 1 || rows > ROW_NUM || colsb < 4 || colsb > COL_NUM || colsb % 4)
+			return false;
+		tile_shape.rows[i] = rows;
+		tile_shape.colsb[i] = colsb;
+		str += len;
+
+		if (*str == '\0' && i == 0) {
+			for (i = 1; i < 8; i++) {
+				tile_shape.rows[i] = rows;
+				tile_shape.colsb[i] = colsb;
+			}
+			return true;
+		}
+		if (*str == '\0')
+			return i == 7;
+		if (*str++ != ',')
+			return false;
+	}
+
+	return false;
+}
+
+/*
+ * parse_options() - The main process entrance.
+ * @ac: The total number of arguments.
+ * @av: Pointer array.
  *
  * Parse arguments of main()
  *
@@ -1062,11 +2297,49 @@ static bool parse_options(int32_t ac, char **av)
 			break;
 		case 'i':
 			ins_type = atoi(optarg);
+			bench_all = false;
 			if (ins_type < INS_TDPBF16PS || ins_type > INS_MAX_NUM) {
 				help();
 				do_nothing = true;
 			}
 			break;
+		case 'B':
+			bench_mode = true;
+			break;
+		case 'r':
+			for (calc_isa = CALC_SCALAR; calc_isa < CALC_COMPARE; calc_isa++)
+				if (strcmp(optarg, calc_isa_name[calc_isa]) == 0)
+					break;
+			if (strcmp(optarg, calc_isa_name[calc_isa])) {
+				help();
+				do_nothing = true;
+			}
+			break;
+		case 'v':
+			verify_interval = atoi(optarg);
+			if (verify_interval < 1) {
+				help();
+				do_nothing = true;
+			}
+			break;
+		case 's':
+			if (!parse_shape(optarg)) {
+				help();
+				do_nothing = true;
+			}
+			break;
+		case 'S':
+			sweep_mode = true;
+			break;
+		case 'l':
+			latency_mode = true;
+			break;
+		case 'p':
+			if (!parse_placement(optarg)) {
+				help();
+				do_nothing = true;
+			}
+			break;
 		case 'h':
 			help();
 			do_nothing = true;
@@ -1095,9 +2368,29 @@ int32_t main(int32_t argc, char **argv)
 	struct sigaction sigact;
 	bool all_thread_done = false;
 
+	for (i = 0; i < 8; i++) {
+		tile_shape.rows[i] = ROW_NUM;
+		tile_shape.colsb[i] = COL_NUM;
+	}
+
 	if (parse_options(argc, argv))
 		exit(-1);
 
+	if (sweep_mode && !bench_mode) {
+		printf("-S needs -B\n");
+		exit(-1);
+	}
+	if (latency_mode && bench_mode) {
+		printf("-l and -B can not be used together\n");
+		exit(-1);
+	}
+	if (sweep_mode && !build_sweep_shapes()) {
+		printf("Fail to malloc memory\n");
+		exit(1);
+	}
+	if (!sweep_mode && !check_shape(&tile_shape, bench_mode ? bench_block : test_chain))
+		exit(-1);
+
 	/* Main thread is attached on CPU 0 */
 	CPU_ZERO(&mask);
 	CPU_SET(0, &mask);
@@ -1106,14 +2399,30 @@ int32_t main(int32_t argc, char **argv)
 	if (!set_tiledata_use())
 		exit(-1);
 
-	if (break_reason == BREAK_BY_TRAP) {
+	if (calc_isa == CALC_COMPARE) {
+		if (!compare_calc_isa())
+			exit(-1);
+		calc_isa = CALC_AUTO;
+	}
+
+	if (!select_calc_isa())
+		exit(-1);
+
+	amx_fp16 = detect_amx_fp16();
+	if (!bench_all && !type_supported(ins_type)) {
+		printf("%s needs AMX-FP16, not supported by this CPU\n", ins_name[ins_type]);
+		exit(-1);
+	}
+	printf("Reference kernels: %s\n", calc_isa_name[calc_isa]);
+
+	if (break_reason == BREAK_BY_TRAP || latency_mode) {
 		sigact.sa_handler = signal_handler;
 		sigemptyset(&sigact.sa_mask);
 		sigact.sa_flags = 0;
 		sigaction(SIGTRAP, &sigact, NULL);
 	}
 
-	if (break_reason == BREAK_BY_SIGNAL) {
+	if (break_reason == BREAK_BY_SIGNAL || latency_mode) {
 		sigact.sa_handler = signal_handler;
 		sigemptyset(&sigact.sa_mask);
 		sigact.sa_flags = 0;
@@ -1125,17 +2434,31 @@ int32_t main(int32_t argc, char **argv)
 	buf_tile1 = (struct __tile *)malloc(sizeof(struct __tile) * thread_num);
 	buf_tile2 = (struct __tile *)malloc(sizeof(struct __tile) * thread_num);
 	buf_tile3 = (struct __tile *)malloc(sizeof(struct __tile) * thread_num);
-	buf_tile4 = (struct __tile *)malloc(sizeof(struct __tile) * thread_num);
 	pthread_t *tid_ptr = (pthread_t *)malloc(sizeof(pthread_t) * thread_num);
 	uint32_t *pthread_idx_ptr = (uint32_t *)malloc(sizeof(int32_t) * thread_num);
 	int32_t **thread_result = (int32_t **)malloc(sizeof(int32_t *) * thread_num);
 
+	thread_mask = (cpu_set_t *)malloc(sizeof(cpu_set_t) * thread_num);
+	thread_report = (struct thread_report *)calloc(thread_num, sizeof(struct thread_report));
+	bench_sec = (double *)calloc(shape_num * (INS_MAX_NUM + 1) * thread_num, sizeof(double));
+	bench_start = (double *)calloc(shape_num * (INS_MAX_NUM + 1), sizeof(double));
+	break_lat = (struct break_latency *)calloc(thread_num * LAT_STATE_NUM *
+						   (BREAK_REASON_MAX + 1),
+						   sizeof(struct break_latency));
+
 	if (!futex_ptr || !thread_done || !tid_ptr || !pthread_idx_ptr || !thread_result ||
-	    !buf_tile1 || !buf_tile2 || !buf_tile3 || !buf_tile4) {
+	    !buf_tile1 || !buf_tile2 || !buf_tile3 || !thread_mask ||
+	    !thread_report || !bench_sec || !bench_start || !break_lat) {
 		printf("Fail to malloc memory\n");
 		exit(1);
 	}
 
+	if (!build_thread_masks())
+		exit(-1);
+
+	/* Sub-threads start timing each instruction type together */
+	pthread_barrier_init(&bench_barrier, NULL, thread_num);
+
 	for (i = 0; i < thread_num; i++) {
 		futex_ptr[i] = FUTEX_VAL;
 		thread_done[i] = false;
@@ -1147,7 +2470,7 @@ int32_t main(int32_t argc, char **argv)
 	sleep(1);
 
 	/* Send SIGUSR1 to each sub-thread */
-	if (break_reason == BREAK_BY_SIGNAL) {
+	if (break_reason == BREAK_BY_SIGNAL && !latency_mode) {
 		while (!all_thread_done) {
 			all_thread_done = true;
 			for (i = 0; i < thread_num; i++) {
@@ -1166,7 +2489,7 @@ int32_t main(int32_t argc, char **argv)
 	}
 
 	/* Wake up the sub-thread waiting on a futex */
-	if (break_reason == BREAK_BY_FUTEX) {
+	if (break_reason == BREAK_BY_FUTEX && !latency_mode) {
 		while (!all_thread_done) {
 			all_thread_done = true;
 			for (i = 0; i < thread_num; i++) {
@@ -1184,6 +2507,17 @@ int32_t main(int32_t argc, char **argv)
 	for (i = 0; i < thread_num; i++)
 		pthread_join(tid_ptr[i], (void **)(&thread_result[i]));
 
+	for (i = 0; i < thread_num; i++)
+		printf("Thread %d: CPU %d, %u cycles in %.6f seconds\n", i,
+		       thread_report[i].cpu, thread_report[i].done_cycles,
+		       thread_report[i].wall_sec);
+
+	if (bench_mode)
+		print_bench();
+
+	if (latency_mode)
+		print_latency();
+
 	free(futex_ptr);
 	free(thread_done);
 	free(tid_ptr);
@@ -1191,7 +2525,12 @@ int32_t main(int32_t argc, char **argv)
 	free(buf_tile1);
 	free(buf_tile2);
 	free(buf_tile3);
-	free(buf_tile4);
+	free(thread_mask);
+	free(thread_report);
+	free(bench_sec);
+	free(sweep_shapes);
+	free(break_lat);
+	pthread_barrier_destroy(&bench_barrier);
 
 	for (i = 0; i < thread_num; i++) {
 		if (thread_result[i]) {
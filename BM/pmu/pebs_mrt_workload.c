@@ -9,6 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #define CACHELINE 64
@@ -17,27 +20,72 @@
 #define LOCAL_RAM_ITERS 200000UL
 #define SNOOP_ITERS 200000UL
 #define SNOOP_BATCH_LINES 256UL
+#define SNOOP_MAX_SLOTS 4
+#define SNOOP_DEF_SLOTS 3
 #define MISS_EVICT_SIZE (2UL * 1024 * 1024)
+#define CALIBRATE_ROUNDS 10000
+#define LAT_LOG2_BUCKETS 32
+#define SWEEP_ITERS 16384UL
+#define CHASE_MIN_LOADS (1UL << 18)
+#define CHASE_MIN_LINKS 4UL
+
+/* From linux/mempolicy.h, without depending on libnuma headers */
+#define MPOL_BIND 2
+#define MPOL_MF_STRICT (1 << 0)
+#define MPOL_MF_MOVE (1 << 1)
+#define MPOL_F_NODE (1 << 0)
+#define MPOL_F_ADDR (1 << 1)
+#define NODE_ROOT "/sys/devices/system/node"
+
+/* Which CPUs a sweep pairs up, one per ... */
+enum sweep_id {
+	SWEEP_NONE,
+	SWEEP_CPU,
+	SWEEP_CORE,
+	SWEEP_DIE,
+	SWEEP_SOCKET,
+};
 
 enum mode_id {
 	MODE_LOCAL_RAM,
 	MODE_SNOOP_NA,
 	MODE_SNOOP_HIT,
 	MODE_SNOOP_MISS,
+	MODE_REMOTE_RAM,
+	MODE_CXL_RAM,
+};
+
+/* TSC cycles of every timed load, one log per pass over the lines */
+struct lat_log {
+	uint32_t *cycles;
+	unsigned long count;
+	unsigned long cap;
 };
 
 struct cacheline_u64 {
 	volatile uint64_t v[CACHELINE / sizeof(uint64_t)];
 } __attribute__((aligned(CACHELINE)));
 
-struct snoop_phase {
-	volatile unsigned int v;
-	uint8_t pad[CACHELINE - sizeof(unsigned int)];
+struct snoop_seq {
+	volatile unsigned long v;
+	uint8_t pad[CACHELINE - sizeof(unsigned long)];
 } __attribute__((aligned(CACHELINE)));
 
-struct snoop_ctx {
-	struct snoop_phase phase;
+/*
+ * One line set of the ring.  Batch i goes through slot i % slots: the
+ * worker sets produced to i + 1 once the lines are in place, the reader
+ * sets consumed to i + 1 once it is done with them.  Each counter has
+ * a line of its own, so only the flag being handed over bounces.
+ */
+struct snoop_slot {
+	struct snoop_seq produced;
+	struct snoop_seq consumed;
 	struct cacheline_u64 lines[SNOOP_BATCH_LINES];
+};
+
+struct snoop_ctx {
+	struct snoop_slot slots[SNOOP_MAX_SLOTS];
+	unsigned long nr_slots;
 	uint8_t *evict_buf;
 	int worker_cpu;
 	enum mode_id mode;
@@ -45,6 +93,12 @@ struct snoop_ctx {
 	volatile uint64_t sink;
 };
 
+struct snoop_result {
+	uint64_t worker_sink;
+	unsigned long loads;
+	double seconds;
+};
+
 static inline void cpu_relax(void)
 {
 	asm volatile("pause" ::: "memory");
@@ -65,14 +119,38 @@ static inline void mfence_all(void)
 	asm volatile("mfence" ::: "memory");
 }
 
-static inline unsigned int phase_load(struct snoop_phase *phase)
+/*
+ * A timed load sits between rdtscp_begin() and rdtscp_end(): the
+ * leading LFENCE keeps earlier work out of the window, RDTSCP at the
+ * end waits for the load to complete and the trailing LFENCE keeps
+ * later instructions from starting before the TSC is read.
+ */
+static inline uint64_t rdtscp_begin(void)
+{
+	uint32_t lo, hi, aux;
+
+	asm volatile("lfence\n\trdtscp\n\tlfence"
+		     : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t rdtscp_end(void)
+{
+	uint32_t lo, hi, aux;
+
+	asm volatile("rdtscp\n\tlfence"
+		     : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline unsigned long seq_load(struct snoop_seq *seq)
 {
-	return __atomic_load_n(&phase->v, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&seq->v, __ATOMIC_ACQUIRE);
 }
 
-static inline void phase_store(struct snoop_phase *phase, unsigned int value)
+static inline void seq_store(struct snoop_seq *seq, unsigned long value)
 {
-	__atomic_store_n(&phase->v, value, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&seq->v, value, __ATOMIC_RELEASE);
 }
 
 static void die_errno(const char *msg)
@@ -81,6 +159,124 @@ static void die_errno(const char *msg)
 	exit(EXIT_FAILURE);
 }
 
+static int time_loads;
+static unsigned long ring_slots = SNOOP_DEF_SLOTS;
+static uint64_t tsc_overhead;
+static double tsc_per_ns;
+
+/*
+ * Cost of an empty rdtscp_begin()/rdtscp_end() window, subtracted
+ * from every timed load, and the TSC rate to convert cycles to ns.
+ */
+static void calibrate_tsc(void)
+{
+	struct timespec req = { 0, 100 * 1000 * 1000 };
+	struct timespec t0, t1;
+	uint64_t c0, c1, delta;
+	int i;
+
+	tsc_overhead = UINT64_MAX;
+	for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+		c0 = rdtscp_begin();
+		c1 = rdtscp_end();
+		delta = c1 - c0;
+		if (delta < tsc_overhead)
+			tsc_overhead = delta;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c0 = rdtscp_begin();
+	nanosleep(&req, NULL);
+	c1 = rdtscp_end();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	tsc_per_ns = (double)(c1 - c0) /
+		     ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec));
+}
+
+static void lat_log_init(struct lat_log *log, unsigned long cap)
+{
+	log->count = 0;
+	log->cap = cap;
+	log->cycles = calloc(cap, sizeof(*log->cycles));
+	if (!log->cycles) {
+		fprintf(stderr, "calloc failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Load one line, timing it if -t is given */
+static inline uint64_t load_line(volatile uint64_t *ptr, struct lat_log *log)
+{
+	uint64_t c0, delta, v;
+
+	if (!time_loads)
+		return *ptr;
+
+	c0 = rdtscp_begin();
+	v = *ptr;
+	delta = rdtscp_end() - c0;
+	delta = delta > tsc_overhead ? delta - tsc_overhead : 0;
+	if (log->count < log->cap)
+		log->cycles[log->count++] = delta > UINT32_MAX ? UINT32_MAX : delta;
+	return v;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t lat_pct(struct lat_log *log, unsigned int per_mille)
+{
+	unsigned long idx = log->count * per_mille / 1000;
+
+	if (idx >= log->count)
+		idx = log->count - 1;
+	return log->cycles[idx];
+}
+
+/*
+ * Print the distribution of one log: percentiles in TSC cycles and ns,
+ * then a log2 histogram in TSC cycles.  PEBS reports load latency in
+ * core cycles, scale by the core/TSC frequency ratio when comparing.
+ */
+static void print_lat_log(const char *mode, const char *pass, struct lat_log *log)
+{
+	static const unsigned int pcts[] = { 0, 100, 500, 900, 990, 999, 1000 };
+	static const char * const names[] = { "min", "p10", "p50", "p90", "p99", "p999", "max" };
+	unsigned long hist[LAT_LOG2_BUCKETS] = { 0 };
+	unsigned long i;
+	unsigned int b;
+	uint32_t v;
+
+	if (!log->count)
+		return;
+
+	qsort(log->cycles, log->count, sizeof(*log->cycles), cmp_u32);
+
+	fprintf(stderr, "latency mode=%s pass=%s loads=%lu tsc_ghz=%.3f overhead=%llu",
+		mode, pass, log->count, tsc_per_ns, (unsigned long long)tsc_overhead);
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		v = lat_pct(log, pcts[i]);
+		fprintf(stderr, " %s=%u/%.1fns", names[i], v, v / tsc_per_ns);
+	}
+	fprintf(stderr, "\n");
+
+	for (i = 0; i < log->count; i++) {
+		v = log->cycles[i];
+		b = v ? 31 - __builtin_clz(v) : 0;
+		hist[b]++;
+	}
+	for (b = 0; b < LAT_LOG2_BUCKETS; b++)
+		if (hist[b])
+			fprintf(stderr, "latency_hist mode=%s pass=%s cycles=[%lu,%lu) count=%lu\n",
+				mode, pass, b ? 1UL << b : 0, 1UL << (b + 1), hist[b]);
+
+	free(log->cycles);
+}
+
 static void bind_cpu(int cpu)
 {
 	cpu_set_t set;
@@ -91,6 +287,12 @@ static void bind_cpu(int cpu)
 		die_errno("sched_setaffinity");
 }
 
+/*
+ * Fill the ring ahead of the reader: flush a slot's lines and load
+ * them into this CPU (then evict them again for snoop-miss), as soon
+ * as the reader has released the slot.  With more than one slot this
+ * overlaps with the reader consuming the previous batches.
+ */
 static void *worker_thread(void *arg)
 {
 	struct snoop_ctx *ctx = arg;
@@ -99,71 +301,294 @@ static void *worker_thread(void *arg)
 
 	bind_cpu(ctx->worker_cpu);
 	for (i = 0; i < ctx->batches; i++) {
+		struct snoop_slot *slot = &ctx->slots[i % ctx->nr_slots];
 		unsigned long j;
 
-		while (phase_load(&ctx->phase) != 0)
-			cpu_relax();
+		if (i >= ctx->nr_slots)
+			while (seq_load(&slot->consumed) != i - ctx->nr_slots + 1)
+				cpu_relax();
 		for (j = 0; j < SNOOP_BATCH_LINES; j++)
-			clflushopt_line((const void *)&ctx->lines[j].v[0]);
+			clflushopt_line((const void *)&slot->lines[j].v[0]);
 		mfence_all();
 		for (j = 0; j < SNOOP_BATCH_LINES; j++)
-			tmp += ctx->lines[j].v[0];
+			tmp += slot->lines[j].v[0];
 		if (ctx->mode == MODE_SNOOP_MISS) {
 			mfence_all();
 			for (j = 0; j < MISS_EVICT_SIZE; j += CACHELINE)
 				tmp += ctx->evict_buf[j];
 		}
 		mfence_all();
-		phase_store(&ctx->phase, 1);
-		while (phase_load(&ctx->phase) != 2)
-			cpu_relax();
-		phase_store(&ctx->phase, 0);
+		seq_store(&slot->produced, i + 1);
 	}
 	ctx->sink = tmp;
 	return NULL;
 }
 
-static void run_local_ram(int reader_cpu, unsigned long iters)
+static const char *mode_name(enum mode_id mode)
 {
-	uint8_t *buf;
-	unsigned long i;
-	volatile uint64_t sink = 0;
+	static const char * const names[] = {
+		[MODE_LOCAL_RAM] = "local-ram",
+		[MODE_SNOOP_NA] = "snoop-na",
+		[MODE_SNOOP_HIT] = "snoop-hit",
+		[MODE_SNOOP_MISS] = "snoop-miss",
+		[MODE_REMOTE_RAM] = "remote-ram",
+		[MODE_CXL_RAM] = "cxl-ram",
+	};
+
+	return names[mode];
+}
 
-	bind_cpu(reader_cpu);
-	if (posix_memalign((void **)&buf, CACHELINE, RAM_SIZE) != 0) {
-		fprintf(stderr, "posix_memalign failed\n");
+static int is_ram_mode(enum mode_id mode)
+{
+	return mode == MODE_LOCAL_RAM || mode == MODE_REMOTE_RAM || mode == MODE_CXL_RAM;
+}
+
+/* Parse a sysfs list like "0-3,8" into a set, returns 0 if unreadable */
+static int read_list(const char *path, cpu_set_t *set)
+{
+	char buf[4096], *str = buf, *end;
+	long first, last;
+	FILE *fp;
+
+	CPU_ZERO(set);
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+	if (!fgets(buf, sizeof(buf), fp))
+		buf[0] = '\0';
+	fclose(fp);
+
+	while (*str && *str != '\n') {
+		first = strtol(str, &end, 10);
+		if (end == str)
+			break;
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+		str = *end == ',' ? end + 1 : end;
+	}
+	return 1;
+}
+
+static int cpu_on_node(int cpu, int node)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+	return access(path, F_OK) == 0;
+}
+
+/*
+ * Default memory node of a mode: remote-ram takes the first node with
+ * memory and CPUs that is not the reader's, i.e. another socket's
+ * DRAM, cxl-ram the first node with memory but no CPUs (CXL or HBM
+ * exposed as a CPU-less node).
+ */
+static int default_node(enum mode_id mode, int reader_cpu)
+{
+	cpu_set_t mem_nodes, cpu_nodes;
+	int node;
+
+	if (!read_list(NODE_ROOT "/has_memory", &mem_nodes) ||
+	    !read_list(NODE_ROOT "/has_cpu", &cpu_nodes)) {
+		fprintf(stderr, "no NUMA information in " NODE_ROOT "\n");
 		exit(EXIT_FAILURE);
 	}
+
+	for (node = 0; node < CPU_SETSIZE; node++) {
+		if (!CPU_ISSET(node, &mem_nodes))
+			continue;
+		if (mode == MODE_REMOTE_RAM && CPU_ISSET(node, &cpu_nodes) &&
+		    !cpu_on_node(reader_cpu, node))
+			return node;
+		if (mode == MODE_CXL_RAM && !CPU_ISSET(node, &cpu_nodes))
+			return node;
+	}
+
+	fprintf(stderr, "no %s memory node found, give one with -n\n",
+		mode == MODE_REMOTE_RAM ? "remote" : "CPU-less");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Map RAM_SIZE bytes, bound to node unless it is negative, and fault
+ * them in.  The node of the first page is checked, so a run never
+ * reports local latency as remote.
+ */
+static uint8_t *alloc_ram(int node)
+{
+	unsigned long mask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = { 0 };
+	uint8_t *buf;
+	int actual = -1;
+
+	buf = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die_errno("mmap");
+
+	if (node >= 0) {
+		if (node >= CPU_SETSIZE) {
+			fprintf(stderr, "node %d out of range\n", node);
+			exit(EXIT_FAILURE);
+		}
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, buf, RAM_SIZE, MPOL_BIND, mask, sizeof(mask) * 8,
+			    MPOL_MF_STRICT | MPOL_MF_MOVE) != 0)
+			die_errno("mbind");
+	}
+
 	memset(buf, 0x5a, RAM_SIZE);
 	mfence_all();
 
+	if (node >= 0) {
+		if (syscall(SYS_get_mempolicy, &actual, NULL, 0, buf,
+			    MPOL_F_NODE | MPOL_F_ADDR) != 0)
+			die_errno("get_mempolicy");
+		if (actual != node) {
+			fprintf(stderr, "buffer is on node %d, not %d\n", actual, node);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return buf;
+}
+
+static void run_ram_mode(enum mode_id mode, int reader_cpu, int node, unsigned long iters)
+{
+	static const char * const sink_names[] = {
+		[MODE_LOCAL_RAM] = "local_ram_sink",
+		[MODE_REMOTE_RAM] = "remote_ram_sink",
+		[MODE_CXL_RAM] = "cxl_ram_sink",
+	};
+	uint8_t *buf;
+	unsigned long i;
+	volatile uint64_t sink = 0;
+	struct lat_log log = { 0 };
+
+	bind_cpu(reader_cpu);
+	if (time_loads)
+		lat_log_init(&log, iters);
+	buf = alloc_ram(node);
+
 	for (i = 0; i < iters; i++) {
 		size_t off = (i * RAM_STRIDE) & (RAM_SIZE - CACHELINE);
 		volatile uint64_t *ptr = (volatile uint64_t *)(buf + off);
 
 		clflushopt_line((const void *)ptr);
 		mfence_all();
-		sink += *ptr;
+		sink += load_line(ptr, &log);
 	}
 
-	fprintf(stderr, "local_ram_sink=%llu\n", (unsigned long long)sink);
-	free(buf);
+	if (node >= 0)
+		fprintf(stderr, "%s=%llu node=%d\n", sink_names[mode],
+			(unsigned long long)sink, node);
+	else
+		fprintf(stderr, "%s=%llu\n", sink_names[mode], (unsigned long long)sink);
+	print_lat_log(mode_name(mode), "1", &log);
+	munmap(buf, RAM_SIZE);
 }
 
-static void run_snoop_mode(int reader_cpu, int worker_cpu, enum mode_id mode, unsigned long iters)
+/*
+ * Link lines stride bytes apart, starting at buf, into one randomly
+ * ordered cycle, so that neither the prefetchers nor the out-of-order
+ * core can run ahead of the chase.
+ */
+static void build_chase(uint8_t *buf, unsigned long links, unsigned long stride)
+{
+	unsigned long *order, i, j, tmp;
+	unsigned int seed = 1;
+
+	order = malloc(links * sizeof(*order));
+	if (!order) {
+		fprintf(stderr, "malloc failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < links; i++)
+		order[i] = i;
+	for (i = links - 1; i > 0; i--) {
+		j = (unsigned long)rand_r(&seed) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < links; i++)
+		*(void **)(buf + order[i] * stride) = buf + order[(i + 1) % links] * stride;
+	free(order);
+}
+
+/*
+ * Pointer-chase every working set from 4KB to RAM_SIZE with 64B, 256B
+ * and 4KB strides on the mode's memory node, and print the average
+ * load latency of each as CSV on stdout.  Caches and TLBs are left
+ * alone, so the curve shows every level down to the node's memory.
+ */
+static void run_chase_sweep(enum mode_id mode, int reader_cpu, int node)
+{
+	static const unsigned long strides[] = { CACHELINE, 256, RAM_STRIDE };
+	unsigned long ws, links, loads, i, k;
+	uint64_t c0, cycles;
+	uint8_t *buf;
+	void **p;
+
+	bind_cpu(reader_cpu);
+	buf = alloc_ram(node);
+
+	printf("mode,node,ws_bytes,stride,loads,cycles_per_load,ns_per_load\n");
+	for (ws = 4096; ws <= RAM_SIZE; ws *= 4) {
+		for (k = 0; k < sizeof(strides) / sizeof(strides[0]); k++) {
+			links = ws / strides[k];
+			if (links < CHASE_MIN_LINKS)
+				continue;
+			loads = links > CHASE_MIN_LOADS ? links : CHASE_MIN_LOADS;
+			build_chase(buf, links, strides[k]);
+
+			/* One lap to warm up whatever fits, then the timed loads */
+			p = (void **)buf;
+			for (i = 0; i < links; i++)
+				p = *p;
+			c0 = rdtscp_begin();
+			for (i = 0; i < loads; i++)
+				p = *p;
+			cycles = rdtscp_end() - c0;
+			asm volatile("" : : "r"(p));
+
+			printf("%s,%d,%lu,%lu,%lu,%.1f,%.2f\n", mode_name(mode), node, ws,
+			       strides[k], loads, (double)cycles / loads,
+			       (double)cycles / loads / tsc_per_ns);
+			fflush(stdout);
+		}
+	}
+
+	munmap(buf, RAM_SIZE);
+}
+
+/*
+ * Run the reader side on reader_cpu and, except for snoop-na, a worker
+ * thread on worker_cpu that keeps up to ring_slots batches ready ahead
+ * of the reader.  Timed loads go to the first and second reader pass
+ * logs.  Returns the reader sink, the worker's and the reader's first
+ * pass rate in *res.
+ */
+static uint64_t snoop_loads(int reader_cpu, int worker_cpu, enum mode_id mode,
+			    unsigned long iters, struct lat_log *first,
+			    struct lat_log *second, struct snoop_result *res)
 {
 	struct snoop_ctx ctx;
+	struct timespec t0, t1;
 	pthread_t worker;
-	unsigned long i;
+	unsigned long i, k;
 	volatile uint64_t sink = 0;
 
 	bind_cpu(reader_cpu);
 	memset(&ctx, 0, sizeof(ctx));
+	ctx.nr_slots = mode == MODE_SNOOP_NA ? 1 : ring_slots;
 	ctx.worker_cpu = worker_cpu;
 	ctx.mode = mode;
 	ctx.batches = (iters + SNOOP_BATCH_LINES - 1) / SNOOP_BATCH_LINES;
-	for (i = 0; i < SNOOP_BATCH_LINES; i++)
-		ctx.lines[i].v[0] = 0x123456789abcdef0ULL + i;
+	for (k = 0; k < ctx.nr_slots; k++)
+		for (i = 0; i < SNOOP_BATCH_LINES; i++)
+			ctx.slots[k].lines[i].v[0] = 0x123456789abcdef0ULL + k * SNOOP_BATCH_LINES + i;
 	if (mode == MODE_SNOOP_HIT || mode == MODE_SNOOP_MISS) {
 		if (posix_memalign((void **)&ctx.evict_buf, CACHELINE, MISS_EVICT_SIZE) != 0) {
 			fprintf(stderr, "posix_memalign failed\n");
@@ -171,47 +596,212 @@ static void run_snoop_mode(int reader_cpu, int worker_cpu, enum mode_id mode, un
 		}
 		memset(ctx.evict_buf, 0xa5, MISS_EVICT_SIZE);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 	if (mode != MODE_SNOOP_NA) {
 		if (pthread_create(&worker, NULL, worker_thread, &ctx) != 0)
 			die_errno("pthread_create");
 	}
 
 	for (i = 0; i < ctx.batches; i++) {
+		struct snoop_slot *slot = &ctx.slots[i % ctx.nr_slots];
 		unsigned long j;
 
 		if (mode == MODE_SNOOP_NA) {
 			for (j = 0; j < SNOOP_BATCH_LINES; j++)
-				clflushopt_line((const void *)&ctx.lines[j].v[0]);
+				clflushopt_line((const void *)&slot->lines[j].v[0]);
 			mfence_all();
 			for (j = 0; j < SNOOP_BATCH_LINES; j++)
-				sink += ctx.lines[j].v[0];
+				sink += load_line(&slot->lines[j].v[0], first);
 			continue;
 		}
 
-		while (phase_load(&ctx.phase) != 1)
+		while (seq_load(&slot->produced) != i + 1)
 			cpu_relax();
 		for (j = 0; j < SNOOP_BATCH_LINES; j++)
-			sink += ctx.lines[j].v[0];
+			sink += load_line(&slot->lines[j].v[0], first);
 		if (mode == MODE_SNOOP_HIT) {
 			for (j = 0; j < SNOOP_BATCH_LINES; j++)
-				cldemote_line((const void *)&ctx.lines[j].v[0]);
+				cldemote_line((const void *)&slot->lines[j].v[0]);
 			mfence_all();
 			for (j = 0; j < MISS_EVICT_SIZE; j += CACHELINE)
 				sink += ctx.evict_buf[j];
 		}
 		for (j = 0; j < SNOOP_BATCH_LINES; j++)
-			sink += ctx.lines[j].v[0];
-		phase_store(&ctx.phase, 2);
-		while (phase_load(&ctx.phase) != 0)
-			cpu_relax();
+			sink += load_line(&slot->lines[j].v[0], second);
+		seq_store(&slot->consumed, i + 1);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 
 	if (mode != MODE_SNOOP_NA)
 		pthread_join(worker, NULL);
 	free(ctx.evict_buf);
+	res->worker_sink = ctx.sink;
+	res->loads = ctx.batches * SNOOP_BATCH_LINES;
+	res->seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	return sink;
+}
+
+static void run_snoop_mode(int reader_cpu, int worker_cpu, enum mode_id mode, unsigned long iters)
+{
+	struct lat_log first = { 0 }, second = { 0 };
+	unsigned long lines = (iters + SNOOP_BATCH_LINES - 1) / SNOOP_BATCH_LINES *
+			      SNOOP_BATCH_LINES;
+	struct snoop_result res;
+	uint64_t sink;
+
+	if (time_loads) {
+		lat_log_init(&first, lines);
+		if (mode != MODE_SNOOP_NA)
+			lat_log_init(&second, lines);
+	}
+
+	sink = snoop_loads(reader_cpu, worker_cpu, mode, iters, &first, &second, &res);
 	fprintf(stderr, "snoop_sink=%llu worker_sink=%llu\n",
 		(unsigned long long)sink,
-		(unsigned long long)ctx.sink);
+		(unsigned long long)res.worker_sink);
+	fprintf(stderr, "snoop_rate mode=%s slots=%lu loads=%lu seconds=%.3f loads_per_sec=%.0f\n",
+		mode_name(mode), mode == MODE_SNOOP_NA ? 1 : ring_slots, res.loads,
+		res.seconds, res.seconds > 0 ? res.loads / res.seconds : 0);
+	print_lat_log(mode_name(mode), "1", &first);
+	print_lat_log(mode_name(mode), "2", &second);
+}
+
+static int read_topology(int cpu, const char *name)
+{
+	char path[128];
+	FILE *fp;
+	int id = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &id) != 1)
+		id = -1;
+	fclose(fp);
+	return id;
+}
+
+/*
+ * The CPUs this process may run on, keeping only the first CPU of each
+ * core, die or socket for the representative sweeps.
+ */
+static int sweep_cpus(enum sweep_id sweep, int *cpus)
+{
+	int key[CPU_SETSIZE][3];
+	cpu_set_t allowed;
+	int cpu, n = 0, i, pkg, die, core;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		die_errno("sched_getaffinity");
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		pkg = read_topology(cpu, "physical_package_id");
+		die = sweep >= SWEEP_SOCKET ? 0 : read_topology(cpu, "die_id");
+		core = sweep >= SWEEP_DIE ? 0 : read_topology(cpu, "core_id");
+		if (sweep == SWEEP_CPU)
+			core = cpu;
+		for (i = 0; i < n; i++)
+			if (key[i][0] == pkg && key[i][1] == die && key[i][2] == core)
+				break;
+		if (i < n)
+			continue;
+		key[n][0] = pkg;
+		key[n][1] = die;
+		key[n][2] = core;
+		cpus[n++] = cpu;
+	}
+
+	return n;
+}
+
+static uint32_t lat_log_p50(struct lat_log *log)
+{
+	uint32_t v;
+
+	if (!log->count)
+		return 0;
+	qsort(log->cycles, log->count, sizeof(*log->cycles), cmp_u32);
+	v = lat_pct(log, 500);
+	free(log->cycles);
+	return v;
+}
+
+/*
+ * Run the snoop mode for every (reader, worker) pair of the swept CPUs
+ * and print the median latency of the first reader pass as a CSV
+ * matrix on stdout, one row per reader and one column per worker.
+ */
+static void run_sweep(enum sweep_id sweep, enum mode_id mode, unsigned long iters)
+{
+	static int cpus[CPU_SETSIZE];
+	struct lat_log first, second;
+	unsigned long lines = (iters + SNOOP_BATCH_LINES - 1) / SNOOP_BATCH_LINES *
+			      SNOOP_BATCH_LINES;
+	struct snoop_result res;
+	uint32_t *p50;
+	int n, r, w;
+
+	n = sweep_cpus(sweep, cpus);
+	if (n < 2) {
+		fprintf(stderr, "sweep needs at least 2 CPUs, found %d\n", n);
+		exit(EXIT_FAILURE);
+	}
+	p50 = calloc((size_t)n * n, sizeof(*p50));
+	if (!p50) {
+		fprintf(stderr, "calloc failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (r = 0; r < n; r++) {
+		for (w = 0; w < n; w++) {
+			if (r == w)
+				continue;
+			lat_log_init(&first, lines);
+			lat_log_init(&second, lines);
+			snoop_loads(cpus[r], cpus[w], mode, iters, &first, &second, &res);
+			free(second.cycles);
+			p50[r * n + w] = lat_log_p50(&first);
+			fprintf(stderr, "sweep mode=%s reader=%d worker=%d p50=%u/%.1fns\n",
+				mode_name(mode), cpus[r], cpus[w], p50[r * n + w],
+				p50[r * n + w] / tsc_per_ns);
+		}
+	}
+
+	printf("# mode=%s p50 of the first reader pass in TSC cycles, tsc_ghz=%.3f\n",
+	       mode_name(mode), tsc_per_ns);
+	printf("reader\\worker");
+	for (w = 0; w < n; w++)
+		printf(",%d", cpus[w]);
+	printf("\n");
+	for (r = 0; r < n; r++) {
+		printf("%d", cpus[r]);
+		for (w = 0; w < n; w++) {
+			if (r == w)
+				printf(",");
+			else
+				printf(",%u", p50[r * n + w]);
+		}
+		printf("\n");
+	}
+
+	free(p50);
+}
+
+static enum sweep_id parse_sweep(const char *arg)
+{
+	if (!strcmp(arg, "cpu"))
+		return SWEEP_CPU;
+	if (!strcmp(arg, "core"))
+		return SWEEP_CORE;
+	if (!strcmp(arg, "die"))
+		return SWEEP_DIE;
+	if (!strcmp(arg, "socket"))
+		return SWEEP_SOCKET;
+	fprintf(stderr, "unknown sweep: %s\n", arg);
+	exit(EXIT_FAILURE);
 }
 
 static enum mode_id parse_mode(const char *arg)
@@ -224,6 +814,10 @@ static enum mode_id parse_mode(const char *arg)
 		return MODE_SNOOP_HIT;
 	if (!strcmp(arg, "snoop-miss"))
 		return MODE_SNOOP_MISS;
+	if (!strcmp(arg, "remote-ram"))
+		return MODE_REMOTE_RAM;
+	if (!strcmp(arg, "cxl-ram"))
+		return MODE_CXL_RAM;
 	fprintf(stderr, "unknown mode: %s\n", arg);
 	exit(EXIT_FAILURE);
 }
@@ -231,44 +825,104 @@ static enum mode_id parse_mode(const char *arg)
 int main(int argc, char **argv)
 {
 	enum mode_id mode = MODE_LOCAL_RAM;
+	enum sweep_id sweep = SWEEP_NONE;
 	unsigned long iters = 0;
 	int reader_cpu = 0;
 	int worker_cpu = 1;
+	int node = -1;
+	int chase_sweep = 0;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "i:m:r:w:")) != -1) {
+	while ((opt = getopt(argc, argv, "b:i:m:n:r:s:tWw:")) != -1) {
 		switch (opt) {
+		case 'b':
+			ring_slots = strtoul(optarg, NULL, 0);
+			if (ring_slots < 1 || ring_slots > SNOOP_MAX_SLOTS) {
+				fprintf(stderr, "-b takes 1 to %d line sets\n", SNOOP_MAX_SLOTS);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'i':
 			iters = strtoul(optarg, NULL, 0);
 			break;
 		case 'm':
 			mode = parse_mode(optarg);
 			break;
+		case 'n':
+			node = atoi(optarg);
+			break;
 		case 'r':
 			reader_cpu = atoi(optarg);
 			break;
+		case 's':
+			sweep = parse_sweep(optarg);
+			break;
+		case 't':
+			time_loads = 1;
+			break;
+		case 'W':
+			chase_sweep = 1;
+			break;
 		case 'w':
 			worker_cpu = atoi(optarg);
 			break;
 		default:
 			fprintf(stderr,
-				"usage: %s -m <local-ram|snoop-na|snoop-hit|snoop-miss> [-r cpu] [-w cpu]\n",
+				"usage: %s -m <local-ram|remote-ram|cxl-ram|snoop-na|snoop-hit|snoop-miss>\n"
+				"       [-r cpu] [-w cpu] [-b slots] [-t] [-s cpu|core|die|socket] [-n node] [-W]\n"
+				"  -b  line sets the worker may prepare ahead of the reader, default 3,\n"
+				"      1 hands every batch over in lock step\n"
+				"  -t  time every reader load with RDTSCP and print its distribution\n"
+				"  -s  snoop-hit/miss latency of all reader/worker pairs, one CPU per\n"
+				"      CPU, core, die or socket, as a CSV matrix on stdout\n"
+				"  -n  memory node of the *-ram buffer, remote-ram and cxl-ram pick\n"
+				"      a remote or CPU-less node by default\n"
+				"  -W  pointer-chase working sets and strides of a *-ram mode, CSV on stdout\n",
 				argv[0]);
 			return EXIT_FAILURE;
 		}
 	}
 
+	if (sweep != SWEEP_NONE) {
+		if (mode != MODE_SNOOP_HIT && mode != MODE_SNOOP_MISS) {
+			fprintf(stderr, "-s needs -m snoop-hit or snoop-miss\n");
+			return EXIT_FAILURE;
+		}
+		time_loads = 1;
+		calibrate_tsc();
+		run_sweep(sweep, mode, iters ? iters : SWEEP_ITERS);
+		return EXIT_SUCCESS;
+	}
+
+	if ((node >= 0 || chase_sweep) && !is_ram_mode(mode)) {
+		fprintf(stderr, "-n and -W need a *-ram mode\n");
+		return EXIT_FAILURE;
+	}
+	if (node < 0 && (mode == MODE_REMOTE_RAM || mode == MODE_CXL_RAM))
+		node = default_node(mode, reader_cpu);
+
+	if (chase_sweep) {
+		calibrate_tsc();
+		run_chase_sweep(mode, reader_cpu, node);
+		return EXIT_SUCCESS;
+	}
+
 	if (!iters)
-		iters = mode == MODE_LOCAL_RAM ? LOCAL_RAM_ITERS : SNOOP_ITERS;
+		iters = is_ram_mode(mode) ? LOCAL_RAM_ITERS : SNOOP_ITERS;
 
-	if (reader_cpu == worker_cpu && mode != MODE_SNOOP_NA && mode != MODE_LOCAL_RAM) {
+	if (reader_cpu == worker_cpu && mode != MODE_SNOOP_NA && !is_ram_mode(mode)) {
 		fprintf(stderr, "reader and worker CPUs must differ\n");
 		return EXIT_FAILURE;
 	}
 
+	if (time_loads)
+		calibrate_tsc();
+
 	switch (mode) {
 	case MODE_LOCAL_RAM:
-		run_local_ram(reader_cpu, iters);
+	case MODE_REMOTE_RAM:
+	case MODE_CXL_RAM:
+		run_ram_mode(mode, reader_cpu, node, iters);
 		break;
 	case MODE_SNOOP_NA:
 	case MODE_SNOOP_HIT:
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2026 Intel Corporation.
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "utils.h"
+
+#define AUX_SIZE	(1024 * PAGESIZE)
+#define RING_SIZE	(64L * 1024 * 1024)
+#define SORT_LEN	4096
+
+static int cmp_int(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Branchy user space load for the traced child: sort random arrays */
+static void sort_forever(int go)
+{
+	int data[SORT_LEN];
+	char c;
+	int i;
+
+	if (read(go, &c, 1) != 1)
+		exit(1);
+	for (;;) {
+		for (i = 0; i < SORT_LEN; i++)
+			data[i] = rand();
+		qsort(data, SORT_LEN, sizeof(data[0]), cmp_int);
+	}
+}
+
+static double elapsed_sec(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * streaming trace check :
+ *  trace a sorting child for some seconds while consuming the AUX area
+ *  continuously, in full or snapshot mode, into a file or memory ring,
+ *  then report trace bandwidth and loss
+ *	PASS will return 0 and FAIL will return 1
+ */
+int stream_test(int mode, int seconds, const char *path)
+{
+	unsigned int FAIL = 0;
+	struct perf_event_attr attr;
+	struct pt_stream *st;
+	struct timespec t0;
+	int fde, go[2];
+	pid_t pid;
+
+	if (pipe(go) != 0) {
+		perror("pipe");
+		FAIL = 1;
+		goto onerror;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		FAIL = 1;
+		goto onerror;
+	}
+	if (pid == 0)
+		sort_forever(go[0]);
+
+	//initial attribute for PT
+	init_evt_attribute(&attr);
+	attr.exclude_kernel = 1;
+	attr.aux_watermark = AUX_SIZE / 4;
+
+	//only get trace for the child
+	fde = sys_perf_event_open(&attr, pid, -1, -1, 0);
+	if (fde < 0) {
+		perror("perf_event_open");
+		FAIL = 1;
+		goto onkill;
+	}
+	/* map event : snapshot (2) or full (1) */
+	st = pt_stream_open(fde, AUX_SIZE, mode == 2, path, path ? 0 : RING_SIZE);
+	if (!st) {
+		close(fde);
+		FAIL = 1;
+		goto onkill;
+	}
+
+	if (pt_stream_start(st) != 0)
+		FAIL = 1;
+	if (write(go[1], "g", 1) != 1) {
+		perror("write");
+		FAIL = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (!FAIL && elapsed_sec(&t0) < seconds)
+		if (pt_stream_consume(st, mode == 2 ? 100 : 10) != 0)
+			FAIL = 1;
+	if (pt_stream_stop(st) != 0)
+		FAIL = 1;
+
+	pt_stream_report(st);
+	if (st->bytes == 0) {
+		printf("No trace generated!\n");
+		FAIL = 1;
+	}
+	/* a snapshot takes at most the whole AUX area */
+	if (mode == 2 && (st->overruns > st->snapshots ||
+			  st->bytes > st->snapshots * AUX_SIZE)) {
+		printf("%llu bytes, %llu overruns in %llu snapshots of %d bytes!\n",
+		       st->bytes, st->overruns, st->snapshots, AUX_SIZE);
+		FAIL = 1;
+	}
+	/* full mode trace starts with a PSB, the ring may have wrapped since */
+	if (!FAIL && mode == 1 &&
+	    seek_pck_w_lib(ppt_psb, (__u64 *)st->first, st->first_len / sizeof(__u64)) != 0) {
+		printf("PSB should be found at the start of the trace!\n");
+		FAIL = 1;
+	}
+
+	pt_stream_close(st);
+	close(fde);
+onkill:
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+onerror:
+	printf("streaming trace check %s\n", FAIL ? "[FAIL] streaming trace check: FAIL.\n"
+		: "[PASS] streaming trace check: PASS.\n");
+	return FAIL;
+}
+
+/**
+ * streaming trace test :
+ *  ./stream 1 [seconds] [file]
+ *  Full trace, AUX area consumed as it fills.
+ *  ./stream 2 [seconds] [file]
+ *  Snapshot trace, AUX area taken in periodic snapshots.
+ *	Raw trace goes to file if given, else to a 64MB memory ring.
+ *	PASS will return 0 and FAIL will return 1
+ *	If skip case will return 2
+ *  CASE ID=1 for full; CASE ID=2 for snapshot
+ */
+int main(int argc, char *argv[])
+{
+	int CASEID = 0;
+	int seconds = 2;
+	const char *path = NULL;
+	int result = 0;
+
+	if (argc >= 2)
+		CASEID = atoi(argv[1]);
+	if (argc >= 3)
+		seconds = atoi(argv[2]);
+	if (argc >= 4)
+		path = argv[3];
+	printf("CASE ID = %d\n", CASEID);
+
+	switch (CASEID) {
+	case 1:
+	case 2:
+		result = stream_test(CASEID, seconds, path);
+		break;
+	default:
+		printf("CASE ID is invalid, please input valid ID!\n");
+		result = 2;
+		break;
+	}
+	printf("CASE result = %d\n", result);
+	return result;
+}
@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (c) 2022 Intel Corporation.
 
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
 #include "utils.h"
 
 #define BIT(nr)                 (1UL << (nr))
@@ -12,7 +16,16 @@
 #define PT_CTL_DISRETC RTIT_CTL_DISRETC
 #endif
 
+#ifndef PERF_AUX_FLAG_PARTIAL
+#define PERF_AUX_FLAG_PARTIAL 0x04
+#endif
+#ifndef PERF_AUX_FLAG_COLLISION
+#define PERF_AUX_FLAG_COLLISION 0x08
+#endif
+
 #define PT_PMU_DIR "/sys/devices/intel_pt/"
+/* User page plus data ring mapped by create_map() */
+#define PT_BASE_SIZE (17 * 4096)
 
 int seek_pck_w_lib(enum pt_packet_type pt_type, __u64 *buf_ev, long bufsize)
 {
@@ -123,7 +136,7 @@ __u64 **create_map(int fde, long bufsize, int sn_fu_sm, int *fdi)
 	else
 		pro_to = PROT_READ;
 	/* Perf buffer is 64 Kio -- max value */
-	p_buf_size = 17 * 4096;// TBD -- 65536;
+	p_buf_size = PT_BASE_SIZE;// TBD -- 65536;
 	/* sampling : itrace_sample_size should be less */
 	if (sn_fu_sm == 2)
 		p_buf_size = bufsize;
@@ -144,7 +157,7 @@ void del_map(__u64 **buf_ev, long bufsize, int sn_fu_sm, int fdi)
 	long p_buf_size;
 
 	/* Perf buffer is 64 Kio -- max value */
-	p_buf_size = 17 * 4096;// TBD -- 65536
+	p_buf_size = PT_BASE_SIZE;// TBD -- 65536
 	/* sampling : itrace_sample_size should be less */
 	if (sn_fu_sm == 2)
 		p_buf_size = bufsize;
@@ -165,3 +178,307 @@ int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
 	fd = syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 	return fd;
 }
+
+/*
+ * streaming AUX consumer
+ */
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Copy len bytes at pos of a power-of-two sized ring, wrapping at its end */
+static void ring_read(const __u8 *ring, __u64 size, __u64 pos, void *dst, __u64 len)
+{
+	__u64 off = pos & (size - 1);
+	__u64 n = len < size - off ? len : size - off;
+
+	memcpy(dst, ring + off, n);
+	if (len > n)
+		memcpy((__u8 *)dst + n, ring, len - n);
+}
+
+static int stream_write(struct pt_stream *st, const __u8 *src, __u64 len)
+{
+	__u64 off, n, done;
+	ssize_t ret;
+
+	if (st->first_len < PT_STREAM_FIRST) {
+		n = len < (__u64)(PT_STREAM_FIRST - st->first_len) ?
+		    len : (__u64)(PT_STREAM_FIRST - st->first_len);
+		memcpy(st->first + st->first_len, src, n);
+		st->first_len += n;
+	}
+	st->bytes += len;
+	if (st->ring) {
+		for (done = 0; done < len; done += n) {
+			off = st->ring_head % st->ring_size;
+			n = len - done < st->ring_size - off ? len - done : st->ring_size - off;
+			memcpy(st->ring + off, src + done, n);
+			st->ring_head += n;
+		}
+	}
+	if (st->out_fd < 0)
+		return 0;
+	for (done = 0; done < len; done += ret) {
+		ret = write(st->out_fd, src + done, len - done);
+		if (ret < 0) {
+			perror("write trace");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Stream AUX bytes [from, from + len), len is at most the AUX size */
+static int stream_aux(struct pt_stream *st, __u64 from, __u64 len)
+{
+	__u8 *aux = (__u8 *)st->buf_m[1];
+	__u64 off = from & (st->aux_size - 1);
+	__u64 n = len < st->aux_size - off ? len : st->aux_size - off;
+
+	if (stream_write(st, aux + off, n))
+		return -1;
+	if (len > n)
+		return stream_write(st, aux, len - n);
+	return 0;
+}
+
+/*
+ * Consume the records of the perf data ring, counting the AUX records
+ * by flag: TRUNCATED means the AUX area was full and tracing stopped
+ * until it was consumed, which is where full mode loses trace.
+ */
+static void drain_data(struct pt_stream *st)
+{
+	struct perf_event_mmap_page *pc = (struct perf_event_mmap_page *)st->buf_m[0];
+	__u8 *data = (__u8 *)pc + (pc->data_offset ? pc->data_offset : PAGESIZE);
+	__u64 size = pc->data_size ? pc->data_size : 16 * PAGESIZE;
+	__u64 head = __atomic_load_n(&pc->data_head, __ATOMIC_ACQUIRE);
+	struct perf_event_header hdr;
+	struct {
+		struct perf_event_header hdr;
+		__u64 aux_offset;
+		__u64 aux_size;
+		__u64 flags;
+	} aux;
+	struct {
+		struct perf_event_header hdr;
+		__u64 id;
+		__u64 lost;
+	} lost;
+
+	while (st->data_tail + sizeof(hdr) <= head) {
+		ring_read(data, size, st->data_tail, &hdr, sizeof(hdr));
+		if (hdr.size < sizeof(hdr))
+			break;
+		if (hdr.type == PERF_RECORD_AUX && hdr.size >= sizeof(aux)) {
+			ring_read(data, size, st->data_tail, &aux, sizeof(aux));
+			st->aux_records++;
+			if (aux.flags & PERF_AUX_FLAG_TRUNCATED)
+				st->truncated++;
+			if (aux.flags & PERF_AUX_FLAG_PARTIAL)
+				st->partial++;
+			if (aux.flags & PERF_AUX_FLAG_COLLISION)
+				st->collision++;
+		} else if (hdr.type == PERF_RECORD_LOST && hdr.size >= sizeof(lost)) {
+			ring_read(data, size, st->data_tail, &lost, sizeof(lost));
+			st->lost_records += lost.lost;
+		}
+		st->data_tail += hdr.size;
+	}
+	__atomic_store_n(&pc->data_tail, st->data_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Full mode: everything between our tail and aux_head is new trace,
+ * stream it and hand the space back by moving aux_tail.
+ */
+static int drain_aux(struct pt_stream *st)
+{
+	struct perf_event_mmap_page *pc = (struct perf_event_mmap_page *)st->buf_m[0];
+	__u64 head = __atomic_load_n(&pc->aux_head, __ATOMIC_ACQUIRE);
+	__u64 len = head - st->aux_tail;
+	int ret;
+
+	if (len > (__u64)st->aux_size) {
+		printf("aux_head %llu ran %llu bytes past aux_tail %llu\n",
+		       head, len, st->aux_tail);
+		st->aux_tail = head - st->aux_size;
+		len = st->aux_size;
+	}
+	ret = stream_aux(st, st->aux_tail, len);
+	st->aux_tail = head;
+	__atomic_store_n(&pc->aux_tail, head, __ATOMIC_RELEASE);
+	return ret;
+}
+
+/*
+ * Overwrite (snapshot) mode: the hardware keeps overwriting the AUX
+ * area and aux_head is only the offset it writes at, so stop the event
+ * and take what was written since the last snapshot, from the previous
+ * offset up to the current one.  Offsets alone cannot tell a wrap
+ * past the previous offset, so like perf compare the bytes just before
+ * it with a copy taken at the last snapshot: if they changed, take the
+ * whole area and count an overrun, the trace before it is lost.
+ */
+static int snapshot_aux(struct pt_stream *st)
+{
+	struct perf_event_mmap_page *pc = (struct perf_event_mmap_page *)st->buf_m[0];
+	__u8 *aux = (__u8 *)st->buf_m[1];
+	__u8 cur[PT_SNAPSHOT_REF];
+	__u64 head, len;
+	int ret;
+
+	if (st->running && ioctl(st->fde, PERF_EVENT_IOC_DISABLE) != 0) {
+		printf("ioctl with PERF_EVENT_IOC_DISABLE is failed!\n");
+		return -1;
+	}
+	drain_data(st);
+	head = __atomic_load_n(&pc->aux_head, __ATOMIC_ACQUIRE) & (st->aux_size - 1);
+	ring_read(aux, st->aux_size, st->aux_tail - PT_SNAPSHOT_REF, cur, PT_SNAPSHOT_REF);
+	if (memcmp(cur, st->snap_ref, PT_SNAPSHOT_REF)) {
+		st->overruns++;
+		len = st->aux_size;
+	} else {
+		len = (head - st->aux_tail) & (st->aux_size - 1);
+	}
+	ret = stream_aux(st, head - len, len);
+	ring_read(aux, st->aux_size, head - PT_SNAPSHOT_REF, st->snap_ref, PT_SNAPSHOT_REF);
+	st->aux_tail = head;
+	st->snapshots++;
+	if (st->running && ioctl(st->fde, PERF_EVENT_IOC_ENABLE) != 0) {
+		printf("ioctl with PERF_EVENT_IOC_ENABLE is failed!\n");
+		return -1;
+	}
+	return ret;
+}
+
+/*
+ * Map the AUX area of a disabled PT event fde: aux_size bytes, a power
+ * of two number of pages, read-only in overwrite mode.  Consumed trace
+ * goes to the file at path if given, and to an in-memory ring of
+ * ring_size bytes if that is not 0; the ring keeps the newest bytes,
+ * and starts at the first consumed byte as long as ring_head is at
+ * most ring_size.
+ */
+struct pt_stream *pt_stream_open(int fde, long aux_size, int overwrite,
+				 const char *path, long ring_size)
+{
+	struct pt_stream *st;
+
+	if (aux_size < PAGESIZE || (aux_size & (aux_size - 1))) {
+		printf("aux size %ld is not a power of two pages!\n", aux_size);
+		return NULL;
+	}
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return NULL;
+	st->fde = fde;
+	st->overwrite = overwrite;
+	st->aux_size = aux_size;
+	st->out_fd = -1;
+
+	/* map event : snapshot (0) or full (1) */
+	st->buf_m = create_map(fde, aux_size, overwrite ? 0 : 1, &st->fdi);
+	if (!st->buf_m || st->buf_m[0] == MAP_FAILED || st->buf_m[1] == MAP_FAILED) {
+		perror("Stream create_map");
+		if (st->buf_m && st->buf_m[0] != MAP_FAILED)
+			munmap(st->buf_m[0], PT_BASE_SIZE);
+		free(st->buf_m);
+		free(st);
+		return NULL;
+	}
+	if (path) {
+		st->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (st->out_fd < 0) {
+			perror(path);
+			pt_stream_close(st);
+			return NULL;
+		}
+	}
+	if (ring_size > 0) {
+		st->ring = malloc(ring_size);
+		if (!st->ring) {
+			printf("malloc of %ld byte ring is failed!\n", ring_size);
+			pt_stream_close(st);
+			return NULL;
+		}
+		st->ring_size = ring_size;
+	}
+	return st;
+}
+
+int pt_stream_start(struct pt_stream *st)
+{
+	if (ioctl(st->fde, PERF_EVENT_IOC_RESET) != 0 ||
+	    ioctl(st->fde, PERF_EVENT_IOC_ENABLE) != 0) {
+		printf("ioctl with PERF_EVENT_IOC_ENABLE is failed!\n");
+		return -1;
+	}
+	st->start = now_sec();
+	st->running = 1;
+	return 0;
+}
+
+/* Stop tracing and consume what is left */
+int pt_stream_stop(struct pt_stream *st)
+{
+	if (!st->running)
+		return 0;
+	if (ioctl(st->fde, PERF_EVENT_IOC_DISABLE) != 0) {
+		printf("ioctl with PERF_EVENT_IOC_DISABLE is failed!\n");
+		return -1;
+	}
+	st->elapsed += now_sec() - st->start;
+	st->running = 0;
+	return pt_stream_consume(st, 0);
+}
+
+/*
+ * Wait up to timeout_ms for the AUX watermark (attr.aux_watermark) of a
+ * running full mode event, then consume the data ring and the AUX area.
+ * Call it in a loop for as long as the workload runs.
+ */
+int pt_stream_consume(struct pt_stream *st, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = st->fde, .events = POLLIN };
+
+	if (st->running && timeout_ms > 0)
+		poll(&pfd, 1, timeout_ms);
+	if (st->overwrite)
+		return snapshot_aux(st);
+	drain_data(st);
+	return drain_aux(st);
+}
+
+void pt_stream_report(struct pt_stream *st)
+{
+	double secs = st->elapsed + (st->running ? now_sec() - st->start : 0);
+
+	printf("stream mode=%s aux_size=%ld bytes=%llu seconds=%.3f MB/s=%.1f\n",
+	       st->overwrite ? "snapshot" : "full", st->aux_size, st->bytes, secs,
+	       secs > 0 ? st->bytes / secs / 1e6 : 0);
+	printf("stream aux_records=%llu truncated=%llu (%.2f%%) partial=%llu collision=%llu lost_records=%llu\n",
+	       st->aux_records, st->truncated,
+	       st->aux_records ? 100.0 * st->truncated / st->aux_records : 0,
+	       st->partial, st->collision, st->lost_records);
+	if (st->overwrite)
+		printf("stream snapshots=%llu overruns=%llu (%.2f%%), bytes are a lower bound if any\n",
+		       st->snapshots, st->overruns,
+		       st->snapshots ? 100.0 * st->overruns / st->snapshots : 0);
+}
+
+/* Unmap and free, the event fd stays with the caller */
+void pt_stream_close(struct pt_stream *st)
+{
+	pt_stream_stop(st);
+	del_map(st->buf_m, st->aux_size, st->overwrite ? 0 : 1, st->fdi);
+	if (st->out_fd >= 0)
+		close(st->out_fd);
+	free(st->ring);
+	free(st);
+}
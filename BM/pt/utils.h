@@ -17,6 +17,43 @@
 
 #define USERMODE 1
 #define KERNELMODE 2
+
+/* AUX bytes before the last snapshot head kept to detect a wrap */
+#define PT_SNAPSHOT_REF 256
+/* First consumed trace bytes kept for checks once the ring wrapped */
+#define PT_STREAM_FIRST 4096
+
+/*
+ * Streaming AUX consumer: drains the PT AUX ring of a perf event while
+ * it is tracing, into a file or an in-memory ring, and keeps the
+ * numbers needed for trace bandwidth and loss.
+ */
+struct pt_stream {
+	int fde;
+	int overwrite;			/* snapshot mode, AUX area mapped read-only */
+	int running;
+	int fdi;
+	__u64 **buf_m;			/* from create_map() */
+	long aux_size;
+	__u64 aux_tail;			/* next AUX byte, area offset if overwrite */
+	__u64 data_tail;		/* next data ring byte to consume */
+	int out_fd;			/* raw trace file, -1 if none */
+	__u8 *ring;			/* in-memory ring, NULL if none */
+	long ring_size;
+	__u64 ring_head;		/* bytes ever written to ring */
+	__u64 bytes;			/* trace bytes consumed */
+	__u8 first[PT_STREAM_FIRST];	/* the first of them */
+	long first_len;
+	__u64 aux_records;		/* PERF_RECORD_AUX seen */
+	__u64 truncated;		/* ... flagged TRUNCATED, trace stopped */
+	__u64 partial;			/* ... flagged PARTIAL */
+	__u64 collision;		/* ... flagged COLLISION */
+	__u64 lost_records;		/* PERF_RECORD_LOST seen */
+	__u64 snapshots;
+	__u64 overruns;			/* ... that found older trace overwritten */
+	__u8 snap_ref[PT_SNAPSHOT_REF];	/* AUX bytes before the last snapshot head */
+	double start, elapsed;		/* seconds */
+};
 int pt_pmu_type(void);
 void init_evt_attribute(struct perf_event_attr *attr);
 int seek_pck_w_lib(enum pt_packet_type pt_type, __u64 *buf_ev, long bufsize);
@@ -24,4 +61,11 @@ __u64 **create_map(int fde, long bufsize, int sn_fu_sm, int *fdi);
 void del_map(__u64 **buf_ev, long bufsize, int sn_fu_sm, int fdi);
 int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
 			int group_fd, unsigned long flags);
+struct pt_stream *pt_stream_open(int fde, long aux_size, int overwrite,
+				 const char *path, long ring_size);
+int pt_stream_start(struct pt_stream *st);
+int pt_stream_stop(struct pt_stream *st);
+int pt_stream_consume(struct pt_stream *st, int timeout_ms);
+void pt_stream_report(struct pt_stream *st);
+void pt_stream_close(struct pt_stream *st);
 #endif /* _UTILS_H_ */
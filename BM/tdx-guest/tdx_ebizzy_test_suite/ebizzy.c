@@ -41,8 +41,10 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <pthread.h>
@@ -50,6 +52,9 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "ebizzy.h"
 
@@ -57,7 +62,28 @@
  * Command line options
  */
 
-static unsigned int always_mmap;
+/* How the searched copies are allocated */
+enum alloc_backend {
+	ALLOC_MALLOC,
+	ALLOC_MMAP,
+	ALLOC_ARENA,
+	ALLOC_POOL,
+};
+
+static const char *backend_names[] = { "malloc", "mmap", "arena", "pool" };
+
+/* What backs mmap()ed memory */
+enum page_backing {
+	PAGES_DEFAULT,
+	PAGES_HUGETLB,
+	PAGES_THP,
+};
+
+static const char *backing_names[] = { "default", "hugetlb", "thp" };
+
+static unsigned int backend = ALLOC_MALLOC;
+static unsigned int backing = PAGES_DEFAULT;
+static unsigned int populate;
 static unsigned int never_mmap;
 static unsigned int chunks;
 static unsigned int use_permissions;
@@ -67,9 +93,13 @@ static unsigned int chunk_size;
 static unsigned int seconds;
 static unsigned int threads;
 static unsigned int verbose;
-static unsigned int linear;
+static unsigned int search_kernel;
+static unsigned int copy_kernel;
 static unsigned int touch_pages;
-static unsigned int no_lib_memcpy;
+static unsigned int interval_ms;
+static char *cpu_list;
+static unsigned int numa_spread;
+static unsigned int latency_every;
 
 /*
  * Other global variables
@@ -81,18 +111,294 @@ static char *cmd;
 static record_t **mem;
 static char **hole_mem;
 static unsigned int page_size;
-static time_t start_time;
+
+#define HUGE_PAGE_SIZE	(2UL * 1024 * 1024)
+#define ARENA_SLOTS	16
+static double start_time;
 static volatile int threads_go;
-static unsigned int records_read;
+static pthread_barrier_t start_barrier;
+
+/*
+ * Per-thread counters, each in its own cache line so that threads
+ * never write to a line another thread or the sampler is reading.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+struct thread_stats {
+	unsigned long records;
+	int first_cpu;
+	int last_cpu;
+	unsigned long migrations;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct thread_stats *thread_stats;
+
+/*
+ * Per-thread allocator state, so that the arena and pool backends
+ * never take a lock.  The arena hands out consecutive slices of one
+ * mapping and wraps around when it is full, so copies keep moving
+ * over ARENA_SLOTS chunks worth of memory.  The pool recycles freed
+ * buffers of the largest copy size through a free list.
+ */
+
+struct thread_alloc {
+	char *arena;
+	size_t arena_size;
+	size_t arena_used;
+	void *pool;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct thread_alloc *thread_allocs;
+
+/*
+ * Latency of the steps of a search, in ns.  Histogram buckets are
+ * log-linear: exact below 16ns, then 16 buckets per power of two, so
+ * percentiles are within 1/16 of the real value.
+ */
+
+#define LAT_SUB_BITS	4
+#define LAT_SUB		(1 << LAT_SUB_BITS)
+#define LAT_BUCKETS	(64 * LAT_SUB)
+
+enum search_op {
+	OP_ALLOC,
+	OP_COPY,
+	OP_SEARCH,
+	OP_FREE,
+	OP_TOTAL,
+	OPS,
+};
+
+static const char *op_names[OPS] = {
+	"alloc", "copy", "search", "free", "total",
+};
+
+struct op_latency {
+	unsigned long count;
+	unsigned long max;
+	unsigned long hist[LAT_BUCKETS];
+};
+
+struct thread_latency {
+	struct op_latency op[OPS];
+};
+
+static struct thread_latency *thread_lats;
+
+/*
+ * Search and copy kernels.  The vector ones are built for their ISA
+ * whatever the compiler flags and checked against the CPU at startup.
+ */
+
+enum kernel_isa {
+	ISA_ANY,
+	ISA_AVX2,
+	ISA_AVX512,
+};
+
+static int cpu_has(unsigned int isa)
+{
+#if defined(__x86_64__)
+	if (isa == ISA_AVX2)
+		return __builtin_cpu_supports("avx2");
+	if (isa == ISA_AVX512)
+		return __builtin_cpu_supports("avx512f");
+#endif
+	return isa == ISA_ANY;
+}
+
+static int compare(const void *p1, const void *p2)
+{
+	return (*(record_t *) p1 - *(record_t *) p2);
+}
+
+static void *lib_bsearch(record_t key, record_t *base, size_t size)
+{
+	return bsearch(&key, base, size / record_size, record_size, compare);
+}
+
+static void *linear_search(record_t key, record_t * base, size_t size)
+{
+	record_t *p;
+	record_t *end = base + (size / record_size);
+
+	for (p = base; p < end; p++)
+		if (*p == key)
+			return p;
+	return NULL;
+}
+
+/*
+ * Binary search without a data dependent branch: the compare only
+ * selects the next base, which compiles to a conditional move.
+ */
+
+static void *branchless_search(record_t key, record_t *base, size_t size)
+{
+	size_t n = size / record_size;
+	size_t half;
+
+	if (n == 0)
+		return NULL;
+
+	while (n > 1) {
+		half = n / 2;
+		base = (base[half] <= key) ? base + half : base;
+		n -= half;
+	}
+
+	return *base == key ? base : NULL;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void *avx2_search(record_t key, record_t *base, size_t size)
+{
+	size_t n = size / record_size;
+	__m256i k = _mm256_set1_epi64x(key);
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+			_mm256_cmpeq_epi64(k, _mm256_loadu_si256(
+				(__m256i *)(base + i)))));
+		if (mask)
+			return base + i + __builtin_ctz(mask);
+	}
+
+	return linear_search(key, base + i, (n - i) * record_size);
+}
+
+__attribute__((target("avx512f")))
+static void *avx512_search(record_t key, record_t *base, size_t size)
+{
+	size_t n = size / record_size;
+	__m512i k = _mm512_set1_epi64(key);
+	__mmask8 mask;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		mask = _mm512_cmpeq_epi64_mask(k, _mm512_loadu_si512(base + i));
+		if (mask)
+			return base + i + __builtin_ctz(mask);
+	}
+
+	return linear_search(key, base + i, (n - i) * record_size);
+}
+#else
+#define avx2_search	linear_search
+#define avx512_search	linear_search
+#endif
+
+enum search_kernel_id {
+	SEARCH_BSEARCH,
+	SEARCH_LINEAR,
+	SEARCH_BRANCHLESS,
+	SEARCH_AVX2,
+	SEARCH_AVX512,
+	SEARCH_KERNELS,
+};
+
+static const struct {
+	const char *name;
+	void *(*search)(record_t key, record_t *base, size_t size);
+	unsigned int isa;
+} search_kernels[SEARCH_KERNELS] = {
+	{ "bsearch",	lib_bsearch,		ISA_ANY },
+	{ "linear",	linear_search,		ISA_ANY },
+	{ "branchless",	branchless_search,	ISA_ANY },
+	{ "avx2",	avx2_search,		ISA_AVX2 },
+	{ "avx512",	avx512_search,		ISA_AVX512 },
+};
+
+static void lib_memcpy(void *dest, void *src, size_t len)
+{
+	memcpy(dest, src, len);
+}
+
+/*
+ * Factor out differences in memcpy implementation by optionally using
+ * our own simple memcpy implementation.
+ */
+
+static void my_memcpy(void *dest, void *src, size_t len)
+{
+	char *d = (char *)dest;
+	char *s = (char *)src;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		d[i] = s[i];
+	return;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void avx2_memcpy(void *dest, void *src, size_t len)
+{
+	char *d = (char *)dest;
+	char *s = (char *)src;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+		_mm256_storeu_si256((__m256i *)(d + i),
+				    _mm256_loadu_si256((__m256i *)(s + i)));
+	my_memcpy(d + i, s + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_memcpy(void *dest, void *src, size_t len)
+{
+	char *d = (char *)dest;
+	char *s = (char *)src;
+	size_t i;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		_mm512_storeu_si512(d + i, _mm512_loadu_si512(s + i));
+	my_memcpy(d + i, s + i, len - i);
+}
+#else
+#define avx2_memcpy	my_memcpy
+#define avx512_memcpy	my_memcpy
+#endif
+
+enum copy_kernel_id {
+	COPY_LIBC,
+	COPY_BYTE,
+	COPY_AVX2,
+	COPY_AVX512,
+	COPY_KERNELS,
+};
+
+static const struct {
+	const char *name;
+	void (*copy)(void *dest, void *src, size_t len);
+	unsigned int isa;
+} copy_kernels[COPY_KERNELS] = {
+	{ "libc",	lib_memcpy,	ISA_ANY },
+	{ "byte",	my_memcpy,	ISA_ANY },
+	{ "avx2",	avx2_memcpy,	ISA_AVX2 },
+	{ "avx512",	avx512_memcpy,	ISA_AVX512 },
+};
 
 static void usage(void)
 {
 	fprintf(stderr, "Usage: %s [options]\n"
 		"-T\t\t Just 'touch' the allocated pages\n"
-		"-l\t\t Don't use library memcpy\n"
-		"-m\t\t Always use mmap instead of malloc\n"
+		"-i <msec>\t Print throughput every <msec> milliseconds\n"
+		"-L <num>\t Time alloc/copy/search/free of every <num>th search\n"
+		"-l\t\t Don't use library memcpy, same as -c byte\n"
+		"-C <cpu-list>\t Pin thread N to the Nth CPU of a list like 0-3,8\n"
+		"-c <copy>\t Copy with libc, byte, avx2 or avx512\n"
+		"-a <backend>\t Allocate copies with malloc, mmap, arena or pool\n"
+		"-F\t\t Populate mmap()ed memory up front (MAP_POPULATE)\n"
+		"-H <pages>\t Back mmap()ed memory with hugetlb or thp pages\n"
+		"-m\t\t Always use mmap instead of malloc, same as -a mmap\n"
 		"-M\t\t Never use mmap\n"
 		"-n <num>\t Number of memory chunks to allocate\n"
+		"-N\t\t Spread threads round-robin over NUMA nodes\n"
 		"-p \t\t Prevent mmap coalescing using permissions\n"
 		"-P \t\t Prevent mmap coalescing using holes\n"
 		"-R\t\t Randomize size of memory to copy and search\n"
@@ -100,7 +406,13 @@ static void usage(void)
 		"-S <seconds>\t Number of seconds to run\n"
 		"-t <num>\t Number of threads (2 * number cpus by default)\n"
 		"-v[v[v]]\t Be verbose (more v's for more verbose)\n"
-		"-z\t\t Linear search instead of binary search\n", cmd);
+		"-x <search>\t Search with bsearch, linear, branchless, avx2 "
+		"or avx512\n"
+		"-z\t\t Linear search instead of binary search, same as "
+		"-x linear\n"
+		"Searches now pick random chunks and keys (an old rand_num() bug\n"
+		"always picked the first), so records/s is lower than, and not\n"
+		"comparable with, results of older ebizzy builds.\n", cmd);
 	exit(1);
 }
 
@@ -132,13 +444,64 @@ static void read_options(int argc, char *argv[])
 	cmd = argv[0];
 	opterr = 1;
 
-	while ((c = getopt(argc, argv, "lmMn:pPRs:S:t:vzT")) != -1) {
+	while ((c = getopt(argc, argv, "a:C:c:FH:i:L:lmMn:NpPRs:S:t:vx:zT")) != -1) {
 		switch (c) {
+		case 'a':
+			for (backend = 0; backend <= ALLOC_POOL; backend++)
+				if (!strcmp(optarg, backend_names[backend]))
+					break;
+			if (backend > ALLOC_POOL)
+				usage();
+			break;
+		case 'c':
+			for (copy_kernel = 0; copy_kernel < COPY_KERNELS;
+			     copy_kernel++)
+				if (!strcmp(optarg, copy_kernels[copy_kernel].name))
+					break;
+			if (copy_kernel == COPY_KERNELS)
+				usage();
+			break;
+		case 'x':
+			for (search_kernel = 0; search_kernel < SEARCH_KERNELS;
+			     search_kernel++)
+				if (!strcmp(optarg,
+					    search_kernels[search_kernel].name))
+					break;
+			if (search_kernel == SEARCH_KERNELS)
+				usage();
+			break;
+		case 'L':
+			latency_every = atoi(optarg);
+			if (latency_every == 0)
+				usage();
+			break;
+		case 'C':
+			cpu_list = optarg;
+			break;
+		case 'N':
+			numa_spread = 1;
+			break;
+		case 'F':
+			populate = 1;
+			break;
+		case 'H':
+			if (!strcmp(optarg, "hugetlb"))
+				backing = PAGES_HUGETLB;
+			else if (!strcmp(optarg, "thp"))
+				backing = PAGES_THP;
+			else
+				usage();
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			if (interval_ms == 0)
+				usage();
+			break;
 		case 'l':
-			no_lib_memcpy = 1;
+			copy_kernel = COPY_BYTE;
 			break;
 		case 'm':
-			always_mmap = 1;
+			backend = ALLOC_MMAP;
 			break;
 		case 'M':
 			never_mmap = 1;
@@ -179,7 +542,7 @@ static void read_options(int argc, char *argv[])
 			verbose++;
 			break;
 		case 'z':
-			linear = 1;
+			search_kernel = SEARCH_LINEAR;
 			break;
 		default:
 			usage();
@@ -192,7 +555,9 @@ static void read_options(int argc, char *argv[])
 		       "(C) 2007 Valerie Henson <val@nmt.edu>\n");
 
 	if (verbose) {
-		printf("always_mmap %u\n", always_mmap);
+		printf("alloc backend %s\n", backend_names[backend]);
+		printf("page backing %s\n", backing_names[backing]);
+		printf("populate %u\n", populate);
 		printf("never_mmap %u\n", never_mmap);
 		printf("chunks %u\n", chunks);
 		printf("prevent coalescing using permissions %u\n",
@@ -203,22 +568,42 @@ static void read_options(int argc, char *argv[])
 		printf("seconds %d\n", seconds);
 		printf("threads %u\n", threads);
 		printf("verbose %u\n", verbose);
-		printf("linear %u\n", linear);
+		printf("search %s\n", search_kernels[search_kernel].name);
+		printf("copy %s\n", copy_kernels[copy_kernel].name);
 		printf("touch_pages %u\n", touch_pages);
 		printf("page size %d\n", page_size);
+		printf("interval_ms %u\n", interval_ms);
+		printf("cpu list %s\n", cpu_list ? cpu_list : "none");
+		printf("numa spread %u\n", numa_spread);
+		printf("latency every %u\n", latency_every);
 	}
 
 	/* Check for incompatible options */
 
-	if (always_mmap && never_mmap) {
-		fprintf(stderr, "Both -m \"always mmap\" and -M "
-			"\"never mmap\" option specified\n");
+	if (backend != ALLOC_MALLOC && never_mmap) {
+		fprintf(stderr, "Both -m/-a \"%s\" and -M "
+			"\"never mmap\" option specified\n",
+			backend_names[backend]);
+		usage();
+	}
+	if (cpu_list && numa_spread) {
+		fprintf(stderr, "Both -C and -N option specified\n");
+		usage();
+	}
+	if (backend == ALLOC_MALLOC && (backing != PAGES_DEFAULT || populate)) {
+		fprintf(stderr, "-H and -F need -a mmap, arena or pool\n");
 		usage();
 	}
 #ifdef __GLIBC__
 	if (never_mmap)
 		mallopt(M_MMAP_MAX, 0);
 #endif
+	if (!cpu_has(search_kernels[search_kernel].isa) ||
+	    !cpu_has(copy_kernels[copy_kernel].isa)) {
+		fprintf(stderr, "CPU does not support the chosen search or "
+			"copy kernel\n");
+		usage();
+	}
 	if (chunk_size < record_size) {
 		fprintf(stderr, "Chunk size %u smaller than record size %u\n",
 			chunk_size, record_size);
@@ -235,15 +620,65 @@ static void touch_mem(char *dest, size_t size)
 	}
 }
 
+static size_t mapped_size(size_t size)
+{
+	if (backing == PAGES_DEFAULT)
+		return size;
+	return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/*
+ * mmap() anonymous memory with the chosen page backing.  THP needs
+ * the mapping aligned to the huge page size, so map an extra huge
+ * page and trim the ends.
+ */
+
+static void *map_mem(size_t size)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t len = mapped_size(size);
+	char *p, *aligned;
+	size_t i;
+
+	if (backing == PAGES_HUGETLB)
+		flags |= MAP_HUGETLB;
+	if (populate && backing != PAGES_THP)
+		flags |= MAP_POPULATE;
+
+	if (backing != PAGES_THP) {
+		p = mmap(NULL, len, (PROT_READ | PROT_WRITE), flags, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+	}
+
+	p = mmap(NULL, len + HUGE_PAGE_SIZE, (PROT_READ | PROT_WRITE),
+		 flags, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	aligned = (char *)(((unsigned long)p + HUGE_PAGE_SIZE - 1) &
+			   ~(HUGE_PAGE_SIZE - 1));
+	if (aligned != p)
+		munmap(p, aligned - p);
+	munmap(aligned + len, p + HUGE_PAGE_SIZE - aligned);
+
+	madvise(aligned, len, MADV_HUGEPAGE);
+
+	/* MAP_POPULATE would fault in small pages before the madvise() */
+	if (populate)
+		for (i = 0; i < len; i += page_size)
+			aligned[i] = 0;
+
+	return aligned;
+}
+
 static void *alloc_mem(size_t size)
 {
 	char *p;
 	int err = 0;
 
-	if (always_mmap) {
-		p = mmap(NULL, size, (PROT_READ | PROT_WRITE),
-			 (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
-		if (p == MAP_FAILED)
+	if (backend != ALLOC_MALLOC) {
+		p = map_mem(size);
+		if (p == NULL)
 			err = 1;
 	} else {
 		p = malloc(size);
@@ -256,6 +691,9 @@ static void *alloc_mem(size_t size)
 			"chunks or size options\n"
 			"Using -n %u chunks and -s %u size\n",
 			size, chunks, chunk_size);
+		if (backing == PAGES_HUGETLB)
+			fprintf(stderr, "Reserve huge pages in "
+				"/proc/sys/vm/nr_hugepages for -H hugetlb\n");
 		exit(1);
 	}
 
@@ -264,26 +702,75 @@ static void *alloc_mem(size_t size)
 
 static void free_mem(void *p, size_t size)
 {
-	if (always_mmap)
-		munmap(p, size);
+	if (backend != ALLOC_MALLOC)
+		munmap(p, mapped_size(size));
 	else
 		free(p);
 }
 
+static void init_thread_alloc(struct thread_alloc *ta)
+{
+	if (backend != ALLOC_ARENA)
+		return;
+
+	ta->arena_size = (size_t)ARENA_SLOTS * chunk_size;
+	ta->arena = alloc_mem(ta->arena_size);
+	ta->arena_used = 0;
+}
+
+static void fini_thread_alloc(struct thread_alloc *ta)
+{
+	void *p;
+
+	if (ta->arena)
+		free_mem(ta->arena, ta->arena_size);
+
+	while ((p = ta->pool) != NULL) {
+		ta->pool = *(void **)p;
+		free_mem(p, chunk_size);
+	}
+}
+
 /*
- * Factor out differences in memcpy implementation by optionally using
- * our own simple memcpy implementation.
+ * Allocate and free the copy of one search.
  */
 
-static void my_memcpy(void *dest, void *src, size_t len)
+static void *copy_alloc(struct thread_alloc *ta, size_t size)
 {
-	char *d = (char *)dest;
-	char *s = (char *)src;
-	int i;
+	void *p;
+
+	switch (backend) {
+	case ALLOC_ARENA:
+		size = (size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+		if (ta->arena_used + size > ta->arena_size)
+			ta->arena_used = 0;
+		p = ta->arena + ta->arena_used;
+		ta->arena_used += size;
+		return p;
+	case ALLOC_POOL:
+		/* Pooled buffers fit the largest copy */
+		p = ta->pool;
+		if (p == NULL)
+			return alloc_mem(chunk_size);
+		ta->pool = *(void **)p;
+		return p;
+	default:
+		return alloc_mem(size);
+	}
+}
 
-	for (i = 0; i < len; i++)
-		d[i] = s[i];
-	return;
+static void copy_free(struct thread_alloc *ta, void *p, size_t size)
+{
+	switch (backend) {
+	case ALLOC_ARENA:
+		break;
+	case ALLOC_POOL:
+		*(void **)p = ta->pool;
+		ta->pool = p;
+		break;
+	default:
+		free_mem(p, size);
+	}
 }
 
 static void allocate(void)
@@ -326,34 +813,67 @@ static void write_pattern(void)
 		printf("Wrote memory\n");
 }
 
-static void *linear_search(record_t key, record_t * base, size_t size)
-{
-	record_t *p;
-	record_t *end = base + (size / record_size);
-
-	for (p = base; p < end; p++)
-		if (*p == key)
-			return p;
-	return NULL;
-}
-
-static int compare(const void *p1, const void *p2)
-{
-	return (*(record_t *) p1 - *(record_t *) p2);
-}
-
 /*
  * Stupid ranged random number function.  We don't care about quality.
  *
  * Inline because it's starting to be a scaling issue.
+ *
+ * This used to be "*state *= 1103515245 + 12345", which stays 0 from a
+ * 0 seed, so every search hit chunk 0 with key 0.  Now that searches
+ * cover all chunks and keys, records/s is roughly half of what older
+ * builds report and cannot be compared with them.
  */
 
 static inline unsigned int rand_num(unsigned int max, unsigned int *state)
 {
-	*state *= 1103515245 + 12345;
+	*state = *state * 1103515245 + 12345;
 	return ((*state / 65536) % max);
 }
 
+static inline unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static double now_seconds(void)
+{
+	return now_ns() / 1e9;
+}
+
+static unsigned int lat_bucket(unsigned long ns)
+{
+	unsigned int msb;
+
+	if (ns < LAT_SUB)
+		return ns;
+	msb = 63 - __builtin_clzl(ns);
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+	       ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Lowest latency that falls into a bucket */
+static unsigned long lat_bucket_ns(unsigned int bucket)
+{
+	unsigned int msb;
+
+	if (bucket < LAT_SUB)
+		return bucket;
+	msb = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	return (unsigned long)(LAT_SUB + (bucket & (LAT_SUB - 1))) <<
+	       (msb - LAT_SUB_BITS);
+}
+
+static void record_latency(struct op_latency *op, unsigned long ns)
+{
+	op->hist[lat_bucket(ns)]++;
+	op->count++;
+	if (ns > op->max)
+		op->max = ns;
+}
+
 /*
  * This function is the meat of the program; the rest is just support.
  *
@@ -366,14 +886,19 @@ static inline unsigned int rand_num(unsigned int max, unsigned int *state)
  *
  */
 
-static unsigned int search_mem(void)
+static unsigned long search_mem(unsigned int id, struct thread_stats *stats,
+				struct thread_alloc *ta,
+				struct thread_latency *lat)
 {
 	record_t key, *found;
 	record_t *src, *copy;
 	unsigned int chunk;
 	size_t copy_size = chunk_size;
-	unsigned int i;
-	unsigned int state = 0;
+	unsigned long i;
+	/* Seed per thread, so threads don't walk the same chunk sequence */
+	unsigned int state = id * 0x9e3779b9U;
+	unsigned long t[OPS] = { 0 };
+	int cpu, sampled;
 
 	for (i = 0; threads_go == 1; i++) {
 		chunk = rand_num(chunks, &state);
@@ -385,28 +910,33 @@ static unsigned int search_mem(void)
 		if (random_size)
 			copy_size = (rand_num(chunk_size / record_size, &state)
 				     + 1) * record_size;
-		copy = alloc_mem(copy_size);
+		sampled = lat && i % latency_every == 0;
+		if (sampled)
+			t[OP_ALLOC] = now_ns();
+
+		copy = copy_alloc(ta, copy_size);
+
+		if (sampled)
+			t[OP_COPY] = now_ns();
 
 		if (touch_pages) {
 			touch_mem((char *)copy, copy_size);
+			if (sampled)
+				t[OP_SEARCH] = now_ns();
 		} else {
 
-			if (no_lib_memcpy)
-				my_memcpy(copy, src, copy_size);
-			else
-				memcpy(copy, src, copy_size);
+			copy_kernels[copy_kernel].copy(copy, src, copy_size);
+
+			if (sampled)
+				t[OP_SEARCH] = now_ns();
 
 			key = rand_num(copy_size / record_size, &state);
 
 			if (verbose > 2)
 				printf("Search key %zu, copy size %zu\n", key,
 				       copy_size);
-			if (linear)
-				found = linear_search(key, copy, copy_size);
-			else
-				found =
-				    bsearch(&key, copy, copy_size / record_size,
-					    record_size, compare);
+			found = search_kernels[search_kernel].search(key, copy,
+								     copy_size);
 
 			/* Below check is mainly for memory corruption or other bug */
 			if (found == NULL) {
@@ -415,7 +945,31 @@ static unsigned int search_mem(void)
 			}
 		}		/* end if ! touch_pages */
 
-		free_mem(copy, copy_size);
+		if (sampled)
+			t[OP_FREE] = now_ns();
+
+		copy_free(ta, copy, copy_size);
+
+		if (sampled) {
+			t[OP_TOTAL] = now_ns();
+			record_latency(&lat->op[OP_ALLOC], t[OP_COPY] - t[OP_ALLOC]);
+			/* With -T, "copy" is touching the pages */
+			record_latency(&lat->op[OP_COPY], t[OP_SEARCH] - t[OP_COPY]);
+			if (!touch_pages)
+				record_latency(&lat->op[OP_SEARCH],
+					       t[OP_FREE] - t[OP_SEARCH]);
+			record_latency(&lat->op[OP_FREE], t[OP_TOTAL] - t[OP_FREE]);
+			record_latency(&lat->op[OP_TOTAL], t[OP_TOTAL] - t[OP_ALLOC]);
+		}
+
+		/* Only this thread writes it, the sampler just reads it */
+		__atomic_store_n(&stats->records, i + 1, __ATOMIC_RELAXED);
+
+		cpu = sched_getcpu();
+		if (cpu != stats->last_cpu) {
+			stats->last_cpu = cpu;
+			stats->migrations++;
+		}
 	}
 
 	return (i);
@@ -423,19 +977,28 @@ static unsigned int search_mem(void)
 
 static void *thread_run(void *arg)
 {
+	unsigned int id = (unsigned long)arg;
 
 	if (verbose > 1)
 		printf("Thread started\n");
 
-	/* Wait for the start signal */
+	/* Map the arena before the clock starts */
+	init_thread_alloc(&thread_allocs[id]);
+
+	/* Sleep until every thread is created and the clock starts */
+	pthread_barrier_wait(&start_barrier);
 
-	while (threads_go == 0) ;
+	thread_stats[id].first_cpu = sched_getcpu();
+	thread_stats[id].last_cpu = thread_stats[id].first_cpu;
 
-	records_read += search_mem();
+	search_mem(id, &thread_stats[id], &thread_allocs[id],
+		   thread_lats ? &thread_lats[id] : NULL);
+
+	fini_thread_alloc(&thread_allocs[id]);
 
 	if (verbose > 1)
 		printf("Thread finished, %f seconds\n",
-		       difftime(time(NULL), start_time));
+		       now_seconds() - start_time);
 
 	return NULL;
 }
@@ -448,10 +1011,262 @@ static struct timeval difftimeval(struct timeval *end, struct timeval *start)
 	return diff;
 }
 
+static unsigned long read_records(unsigned int i)
+{
+	return __atomic_load_n(&thread_stats[i].records, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sleep for the run time, printing the records/s of every interval
+ * if asked to.  Threads keep running while we read their counters.
+ */
+
+static void sample_threads(void)
+{
+	unsigned long last, total;
+	double start, end, prev, now, next;
+	unsigned int i;
+
+	if (!interval_ms) {
+		sleep(seconds);
+		return;
+	}
+
+	start = now_seconds();
+	end = start + seconds;
+	prev = start;
+	last = 0;
+
+	for (next = start + interval_ms / 1e3; prev < end; next += interval_ms / 1e3) {
+		if (next > end)
+			next = end;
+		now = now_seconds();
+		if (next > now)
+			usleep((useconds_t)((next - now) * 1e6));
+		now = now_seconds();
+
+		total = 0;
+		for (i = 0; i < threads; i++)
+			total += read_records(i);
+
+		printf("%8.3f s %lu records/s\n", now - start,
+		       (unsigned long)((total - last) / (now - prev)));
+		last = total;
+		prev = now;
+	}
+}
+
+/*
+ * Parse a CPU list like "0-3,8" into a CPU set, returns the number
+ * of CPUs in it or 0 if it does not parse.
+ */
+
+static int parse_cpu_list(const char *str, cpu_set_t *set)
+{
+	long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*str && *str != '\n') {
+		first = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return 0;
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first)
+				return 0;
+		}
+		if (last >= CPU_SETSIZE)
+			return 0;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		str = end;
+		if (*str == ',')
+			str++;
+	}
+
+	return CPU_COUNT(set);
+}
+
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+	char buf[4096];
+	FILE *fp;
+	int n = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	if (fgets(buf, sizeof(buf), fp))
+		n = parse_cpu_list(buf, set);
+	fclose(fp);
+
+	return n;
+}
+
+static int nth_cpu(cpu_set_t *set, int n)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, set) && n-- == 0)
+			return cpu;
+	return -1;
+}
+
+static int read_node_cpus(int node, cpu_set_t *set)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	return read_cpu_list(path, set);
+}
+
+static int cpu_node(int cpu)
+{
+	cpu_set_t nodes, cpus;
+	int i, node;
+
+	for (i = 0; i < read_cpu_list("/sys/devices/system/node/has_cpu",
+				      &nodes); i++) {
+		node = nth_cpu(&nodes, i);
+		if (read_node_cpus(node, &cpus) && CPU_ISSET(cpu, &cpus))
+			return node;
+	}
+
+	return -1;
+}
+
+/*
+ * Pick the CPUs thread i may run on: the ith CPU of -C, or every
+ * CPU of the ith NUMA node that has CPUs with -N, both wrapping
+ * around, so memory-only (CXL, HBM) nodes are skipped.  Returns 0 if
+ * the thread is not pinned.
+ */
+
+static int thread_cpus(unsigned int i, cpu_set_t *set)
+{
+	cpu_set_t list;
+	int n;
+
+	if (cpu_list) {
+		n = parse_cpu_list(cpu_list, &list);
+		if (n == 0) {
+			fprintf(stderr, "Bad CPU list %s\n", cpu_list);
+			usage();
+		}
+		CPU_ZERO(set);
+		CPU_SET(nth_cpu(&list, i % n), set);
+		return 1;
+	}
+
+	if (numa_spread) {
+		n = read_cpu_list("/sys/devices/system/node/has_cpu", &list);
+		if (n == 0 || !read_node_cpus(nth_cpu(&list, i % n), set)) {
+			fprintf(stderr, "Couldn't read the NUMA nodes\n");
+			exit(1);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Per-thread records/s, and how evenly the threads progressed:
+ * min/max of the thread rates and Jain's fairness index, 1.0 when
+ * every thread read the same number of records.
+ */
+
+static void print_thread_stats(double elapsed)
+{
+	double rate, min = 0, max = 0, sum = 0, sum_sq = 0;
+	unsigned int i;
+
+	for (i = 0; i < threads; i++) {
+		rate = read_records(i) / elapsed;
+		if (verbose || cpu_list || numa_spread)
+			printf("thread %u %lu records/s, cpu %d (node %d) to "
+			       "%d (node %d), %lu migrations\n", i,
+			       (unsigned long)rate, thread_stats[i].first_cpu,
+			       cpu_node(thread_stats[i].first_cpu),
+			       thread_stats[i].last_cpu,
+			       cpu_node(thread_stats[i].last_cpu),
+			       thread_stats[i].migrations);
+		if (i == 0 || rate < min)
+			min = rate;
+		if (i == 0 || rate > max)
+			max = rate;
+		sum += rate;
+		sum_sq += rate * rate;
+	}
+
+	printf("per thread min %lu max %lu records/s, fairness %.3f\n",
+	       (unsigned long)min, (unsigned long)max,
+	       sum_sq ? sum * sum / (threads * sum_sq) : 1.0);
+}
+
+static unsigned long percentile_ns(struct op_latency *op, double pct)
+{
+	unsigned long rank = (unsigned long)(op->count * pct / 100.0);
+	unsigned long seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += op->hist[i];
+		if (seen > rank)
+			return lat_bucket_ns(i);
+	}
+
+	return op->max;
+}
+
+/*
+ * Percentiles of each step over the searches sampled by all threads.
+ */
+
+static void print_latency(void)
+{
+	struct op_latency *sum;
+	unsigned int i, op, b;
+
+	sum = calloc(OPS, sizeof(struct op_latency));
+	if (sum == NULL) {
+		fprintf(stderr, "Couldn't allocate latency summary\n");
+		exit(1);
+	}
+
+	for (i = 0; i < threads; i++)
+		for (op = 0; op < OPS; op++) {
+			sum[op].count += thread_lats[i].op[op].count;
+			if (thread_lats[i].op[op].max > sum[op].max)
+				sum[op].max = thread_lats[i].op[op].max;
+			for (b = 0; b < LAT_BUCKETS; b++)
+				sum[op].hist[b] += thread_lats[i].op[op].hist[b];
+		}
+
+	for (op = 0; op < OPS; op++) {
+		if (!sum[op].count)
+			continue;
+		printf("%-6s p50 %lu p99 %lu p999 %lu max %lu ns, %lu samples\n",
+		       op_names[op], percentile_ns(&sum[op], 50),
+		       percentile_ns(&sum[op], 99), percentile_ns(&sum[op], 99.9),
+		       sum[op].max, sum[op].count);
+	}
+
+	free(sum);
+}
+
 static void start_threads(void)
 {
 	pthread_t thread_array[threads];
+	pthread_attr_t attr;
+	cpu_set_t cpus;
 	double elapsed;
+	unsigned long records_read = 0;
 	unsigned int i;
 	struct rusage start_ru, end_ru;
 	struct timeval usr_time, sys_time;
@@ -460,10 +1275,37 @@ static void start_threads(void)
 	if (verbose)
 		printf("Threads starting\n");
 
+	if (posix_memalign((void **)&thread_stats, CACHE_LINE_SIZE,
+			   threads * sizeof(struct thread_stats)) ||
+	    posix_memalign((void **)&thread_allocs, CACHE_LINE_SIZE,
+			   threads * sizeof(struct thread_alloc))) {
+		fprintf(stderr, "Couldn't allocate thread stats\n");
+		exit(1);
+	}
+	memset(thread_stats, 0, threads * sizeof(struct thread_stats));
+	memset(thread_allocs, 0, threads * sizeof(struct thread_alloc));
+
+	if (latency_every) {
+		thread_lats = calloc(threads, sizeof(struct thread_latency));
+		if (thread_lats == NULL) {
+			fprintf(stderr, "Couldn't allocate latency histograms\n");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, threads + 1);
+
 	for (i = 0; i < threads; i++) {
-		err = pthread_create(&thread_array[i], NULL, thread_run, NULL);
+		/* Pinned threads start on their CPU, before they allocate */
+		pthread_attr_init(&attr);
+		if (thread_cpus(i, &cpus))
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		err = pthread_create(&thread_array[i], &attr, thread_run,
+				     (void *)(unsigned long)i);
+		pthread_attr_destroy(&attr);
 		if (err) {
-			fprintf(stderr, "Error creating thread %d\n", i);
+			fprintf(stderr, "Error creating thread %d: %s\n", i,
+				strerror(err));
 			exit(1);
 		}
 	}
@@ -472,12 +1314,13 @@ static void start_threads(void)
 	 * Begin accounting - this is when we actually do the things
 	 * we want to measure. */
 
-	getrusage(RUSAGE_SELF, &start_ru);
-	start_time = time(NULL);
 	threads_go = 1;
-	sleep(seconds);
+	pthread_barrier_wait(&start_barrier);
+	getrusage(RUSAGE_SELF, &start_ru);
+	start_time = now_seconds();
+	sample_threads();
 	threads_go = 0;
-	elapsed = difftime(time(NULL), start_time);
+	elapsed = now_seconds() - start_time;
 	getrusage(RUSAGE_SELF, &end_ru);
 
 	/*
@@ -495,8 +1338,16 @@ static void start_threads(void)
 	if (verbose)
 		printf("Threads finished\n");
 
+	for (i = 0; i < threads; i++)
+		records_read += read_records(i);
+
 	printf("%u records/s\n",
 	       (unsigned int)(((double)records_read) / elapsed));
+	printf("search %s, copy %s\n", search_kernels[search_kernel].name,
+	       copy_kernels[copy_kernel].name);
+	print_thread_stats(elapsed);
+	if (thread_lats)
+		print_latency();
 
 	usr_time = difftimeval(&end_ru.ru_utime, &start_ru.ru_utime);
 	sys_time = difftimeval(&end_ru.ru_stime, &start_ru.ru_stime);
@@ -29,6 +29,17 @@
 #define _SC_NPROCESSORS_ONLN pthread_num_processors_np()
 #endif
 
-
+/*
+ * Linux specific mmap/madvise flags, ignored elsewhere
+ */
+#ifndef MAP_POPULATE
+#define MAP_POPULATE	0
+#endif
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB	0
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE	MADV_NORMAL
+#endif
 
 #endif /* EBIZZY_H */
@@ -18,7 +18,7 @@ void thread_break(int32_t reason, uint32_t thread_idx);
  * run()
  * complete work in chunks of "data_entries" operations
  * between each chunk, check the time
- * return when requested operations complete, or out of time
+ * return when requested operations complete, or out of time (-d)
  *
  * return operationds completed
  */
@@ -35,6 +35,8 @@ static unsigned long long run(struct work_instance *wi)
 		thread_break(wi->break_reason, wi->thread_number);
 		/* each invocation of work() does "entries" operations */
 		work(dp);
+		if (worker_op_done(wi))
+			break;
 	}
 	unsigned long long tsc_now = rdtsc();
 	return tsc_now;
@@ -18,6 +18,7 @@
 #include "yogini.h"
 #include <err.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -92,8 +93,6 @@ static void work(void *arg)
 	struct thread_data *dp = (struct thread_data *)arg;
 	int entries = dp->data_entries;
 
-	set_tiledata_use();
-
 	for (i = 0; i < entries; ++i) {
 		_tile_loadd(2, dp->input_x + BYTES_PER_VECTOR * i, COL_NUM);
 		_tile_loadd(3, dp->input_y + BYTES_PER_VECTOR * i, COL_NUM);
@@ -117,3 +116,183 @@ struct workload *register_AMX(void)
 {
 	return &w;
 }
+
+/*
+ * AMX_GEMM, AMX_GEMM_BF16: C[M][N] += A[M][K] * B[K][N] as inference
+ * kernels do it. Each 32x32 block of C lives in tmm0-3 for the whole
+ * K loop, tmm4-5 hold two 16-row slices of A and tmm6-7 two 16-column
+ * slices of B, so every tile load feeds two TDPs and C is stored once.
+ * B is VNNI packed: K/(4/esize) rows of N dwords.
+ */
+#define GEMM_BLOCK_M	(2 * ROW_NUM)
+#define GEMM_BLOCK_N	(2 * COL_NUM / 4)
+
+struct gemm_data {
+	char *a;
+	char *b;
+	char *c;
+	void (*kernel)(struct gemm_data *gd);
+};
+
+#define DEFINE_GEMM_KERNEL(_name, _tdp, _esize)					\
+static void _name(struct gemm_data *gd)						\
+{										\
+	size_t lda = (size_t)gemm_k * (_esize);					\
+	size_t ldb = (size_t)gemm_n * 4;					\
+	size_t ldc = (size_t)gemm_n * 4;					\
+	unsigned int m, n, k;							\
+										\
+	for (m = 0; m < gemm_m; m += GEMM_BLOCK_M) {				\
+		for (n = 0; n < gemm_n; n += GEMM_BLOCK_N) {			\
+			char *a = gd->a + m * lda;				\
+			char *b = gd->b + n * 4;				\
+			char *c = gd->c + m * ldc + n * 4;			\
+										\
+			_tile_zero(0);						\
+			_tile_zero(1);						\
+			_tile_zero(2);						\
+			_tile_zero(3);						\
+			for (k = 0; k < gemm_k; k += COL_NUM / (_esize)) {	\
+				char *bk = b + k * (_esize) / 4 * ldb;		\
+										\
+				_tile_loadd(4, a + k * (_esize), lda);		\
+				_tile_loadd(5, a + ROW_NUM * lda + k * (_esize), lda); \
+				_tile_loadd(6, bk, ldb);			\
+				_tile_loadd(7, bk + COL_NUM, ldb);		\
+				_tdp(0, 4, 6);					\
+				_tdp(1, 4, 7);					\
+				_tdp(2, 5, 6);					\
+				_tdp(3, 5, 7);					\
+			}							\
+			_tile_stored(0, c, ldc);				\
+			_tile_stored(1, c + COL_NUM, ldc);			\
+			_tile_stored(2, c + ROW_NUM * ldc, ldc);		\
+			_tile_stored(3, c + ROW_NUM * ldc + COL_NUM, ldc);	\
+		}								\
+	}									\
+}
+
+DEFINE_GEMM_KERNEL(gemm_int8, _tile_dpbssd, 1)
+DEFINE_GEMM_KERNEL(gemm_bf16, _tile_dpbf16ps, 2)
+
+/* small values in [-1, 1), so that the fp32 sums stay finite */
+static uint16_t random_bf16(void)
+{
+	float f = (float)((int)(random() % 256) - 128) / 128;
+	uint32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits >> 16;
+}
+
+static int gemm_init(struct work_instance *wi)
+{
+	struct gemm_data *gd;
+	int bf16 = strcmp(wi->workload->name, "AMX_GEMM_BF16") == 0;
+	size_t esize = bf16 ? 2 : 1;
+	size_t a_elems = (size_t)gemm_m * gemm_k;
+	size_t b_elems = (size_t)gemm_k * gemm_n;
+	size_t i;
+	union __union_tile_config cfg;
+
+	if (!gemm_m || gemm_m % GEMM_BLOCK_M || !gemm_n || gemm_n % GEMM_BLOCK_N ||
+	    !gemm_k || gemm_k % (COL_NUM / esize))
+		errx(-1, "%s: M, N must be multiples of %d and K of %zu.\n",
+		     wi->workload->name, GEMM_BLOCK_M, COL_NUM / esize);
+
+	set_tiledata_use();
+	init_tile_config(&cfg, ROW_NUM, COL_NUM);
+
+	gd = (struct gemm_data *)calloc(1, sizeof(struct gemm_data));
+	if (!gd)
+		err(1, "gemm_data");
+
+	gd->a = worker_alloc(wi, a_elems * esize);
+	gd->b = worker_alloc(wi, b_elems * esize);
+	gd->c = worker_alloc(wi, (size_t)gemm_m * gemm_n * 4);
+
+	for (i = 0; i < a_elems; i++) {
+		if (bf16)
+			((uint16_t *)gd->a)[i] = random_bf16();
+		else
+			gd->a[i] = random();
+	}
+	for (i = 0; i < b_elems; i++) {
+		if (bf16)
+			((uint16_t *)gd->b)[i] = random_bf16();
+		else
+			gd->b[i] = random();
+	}
+
+	gd->kernel = bf16 ? gemm_bf16 : gemm_int8;
+	wi->stats->math_per_op = 2ULL * gemm_m * gemm_n * gemm_k;
+	wi->worker_data = gd;
+
+	return 0;
+}
+
+static int gemm_cleanup(struct work_instance *wi)
+{
+	struct gemm_data *gd = wi->worker_data;
+
+	worker_free(gd->a);
+	worker_free(gd->b);
+	worker_free(gd->c);
+	free(gd);
+	wi->worker_data = NULL;
+
+	return 0;
+}
+
+/*
+ * gemm_run()
+ * one op is one whole M x N x K GEMM, breaks go between GEMMs
+ */
+static unsigned long long gemm_run(struct work_instance *wi)
+{
+	unsigned int count;
+	unsigned int operations = wi->repeat;
+	struct gemm_data *gd = wi->worker_data;
+
+	if (operations == 0)
+		operations = (~0U);
+
+	for (count = 0; count < operations; count++) {
+		thread_break(wi->break_reason, wi->thread_number);
+		gd->kernel(gd);
+		if (worker_op_done(wi))
+			break;
+	}
+
+	return rdtsc();
+}
+
+static struct workload gemm_int8_workload = {
+	"AMX_GEMM",
+	gemm_init,
+	gemm_cleanup,
+	gemm_run,
+};
+
+static struct workload gemm_bf16_workload = {
+	"AMX_GEMM_BF16",
+	gemm_init,
+	gemm_cleanup,
+	gemm_run,
+};
+
+struct workload *register_AMX_GEMM(void)
+{
+	if (cpuid.amx_int8)
+		return &gemm_int8_workload;
+
+	return NULL;
+}
+
+struct workload *register_AMX_GEMM_BF16(void)
+{
+	if (cpuid.amx_bf16)
+		return &gemm_bf16_workload;
+
+	return NULL;
+}
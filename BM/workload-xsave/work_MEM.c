@@ -46,13 +46,8 @@ static int init(struct work_instance *wi)
 		errx(-1, "MEM: working-set size minimum of %dKB.\n",
 		     (2 * MEM_BYTES_PER_ITERATION) / 1024);
 	}
-	dp->buf1 = malloc(wi->wi_bytes / 2);
-	dp->buf2 = malloc(wi->wi_bytes / 2);
-
-	if (!dp->buf1 || !dp->buf2) {
-		perror("malloc");
-		exit(-1);
-	}
+	dp->buf1 = worker_alloc(wi, wi->wi_bytes / 2);
+	dp->buf2 = worker_alloc(wi, wi->wi_bytes / 2);
 
 	wi->worker_data = dp;
 
@@ -63,8 +58,8 @@ static int cleanup(struct work_instance *wi)
 {
 	struct thread_data *dp = wi->worker_data;
 
-	free(dp->buf1);
-	free(dp->buf2);
+	worker_free(dp->buf1);
+	worker_free(dp->buf2);
 	free(dp);
 
 	wi->worker_data = NULL;
@@ -109,6 +104,8 @@ static unsigned long long run(struct work_instance *wi)
 			bytes_done += MEM_BYTES_PER_ITERATION;
 
 			thread_break(wi->break_reason, wi->thread_number);
+			if (worker_op_done(wi))
+				goto done;
 			if (bytes_to_copy && bytes_done >= bytes_to_copy)
 				goto done;
 		}
@@ -1,6 +1,6 @@
 // SPDX-License-Identifier: GPL-2.0-only
 /*
- * offer the "memcpy" workload to yogini
+ * offer the "memcpy" family of workloads to yogini
  *
  * see yogini.8
  *
@@ -17,21 +17,162 @@
 #include <stdio.h>		/* printf(3) */
 #include <stdlib.h>		/* random(3) */
 #include <sched.h>		/* CPU_SET */
+#include <stddef.h>		/* offsetof */
+#include <immintrin.h>
 #include "yogini.h"
 #include "string.h"
 #include <err.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 void thread_break(int32_t reason, uint32_t thread_idx);
-#define MEM_BYTES_PER_ITERATION (4 * 1024)
+
+#define XFEATURE_XTILEDATA 18
+#define ARCH_REQ_XCOMP_PERM 0x1023
+#define TILE_ROWS 16
+#define TILE_COLSB 64
+#define TILE_BYTES (TILE_ROWS * TILE_COLSB)
 
 struct thread_data {
 	char *buf1;
 	char *buf2;
 };
 
+/*
+ * One copy kernel per workload, so that every worker can pick its own
+ * with -w, e.g. "-w memcpy_movsb -w memcpy_avx512_nt".
+ */
+struct copy_workload {
+	struct workload workload;
+	void *(*copy)(void *dest, const void *src, size_t n);
+	void (*setup)(void);		/* per-thread setup before the first copy */
+	unsigned int block_align;	/* block size must be a multiple of it */
+};
+
+static void *movsb_memcpy(void *dest, const void *src, size_t n)
+{
+	void *ret = dest;
+
+	/* Fast with ERMS (CPUID.(EAX=07H,ECX=0):EBX[9]) */
+	asm volatile ("rep movsb"
+		      : "+D" (dest), "+S" (src), "+c" (n)
+		      : : "memory");
+
+	return ret;
+}
+
+/* Streaming stores bypass the caches, src and dest are 32B aligned */
+__attribute__((target("avx2")))
+static void *avx2_nt_memcpy(void *dest, const void *src, size_t n)
+{
+	__m256i *d = dest;
+	const __m256i *s = src;
+	size_t i;
+
+	for (i = 0; i < n / sizeof(__m256i); i += 2) {
+		__m256i v0 = _mm256_load_si256(s + i);
+		__m256i v1 = _mm256_load_si256(s + i + 1);
+
+		_mm256_stream_si256(d + i, v0);
+		_mm256_stream_si256(d + i + 1, v1);
+	}
+	_mm_sfence();
+
+	return dest;
+}
+
+/* Streaming stores bypass the caches, src and dest are 64B aligned */
+__attribute__((target("avx512f")))
+static void *avx512_nt_memcpy(void *dest, const void *src, size_t n)
+{
+	__m512i *d = dest;
+	const __m512i *s = src;
+	size_t i;
+
+	for (i = 0; i < n / sizeof(__m512i); i++)
+		_mm512_stream_si512(d + i, _mm512_load_si512(s + i));
+	_mm_sfence();
+
+	return dest;
+}
+
+/*
+ * Non-temporal loads (VMOVNTDQA). On write-back memory they behave as
+ * ordinary loads on most parts, which is worth measuring as well.
+ */
+__attribute__((target("avx2")))
+static void *ntload_memcpy(void *dest, const void *src, size_t n)
+{
+	__m256i *d = dest;
+	__m256i *s = (__m256i *)src;
+	size_t i;
+
+	for (i = 0; i < n / sizeof(__m256i); i += 2) {
+		__m256i v0 = _mm256_stream_load_si256(s + i);
+		__m256i v1 = _mm256_stream_load_si256(s + i + 1);
+
+		_mm256_store_si256(d + i, v0);
+		_mm256_store_si256(d + i + 1, v1);
+	}
+
+	return dest;
+}
+
+#if __GNUC__ >= 11
+/* Copy through the tile registers, 1KB per TILELOADD/TILESTORED pair */
+__attribute__((target("amx-tile")))
+static void *amx_memcpy(void *dest, const void *src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	size_t off = 0;
+
+	for (; off + 4 * TILE_BYTES <= n; off += 4 * TILE_BYTES) {
+		_tile_loadd(0, s + off, TILE_COLSB);
+		_tile_loadd(1, s + off + TILE_BYTES, TILE_COLSB);
+		_tile_loadd(2, s + off + 2 * TILE_BYTES, TILE_COLSB);
+		_tile_loadd(3, s + off + 3 * TILE_BYTES, TILE_COLSB);
+		_tile_stored(0, d + off, TILE_COLSB);
+		_tile_stored(1, d + off + TILE_BYTES, TILE_COLSB);
+		_tile_stored(2, d + off + 2 * TILE_BYTES, TILE_COLSB);
+		_tile_stored(3, d + off + 3 * TILE_BYTES, TILE_COLSB);
+	}
+	for (; off < n; off += TILE_BYTES) {
+		_tile_loadd(0, s + off, TILE_COLSB);
+		_tile_stored(0, d + off, TILE_COLSB);
+	}
+
+	return dest;
+}
+
+/* Request XTILEDATA and configure all 8 tiles as 16 rows x 64 bytes */
+static void amx_copy_setup(void)
+{
+	uint8_t cfg[64] = { 0 };
+	int i;
+
+	if (syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA))
+		printf("Fail to do XFEATURE_XTILEDATA\n");
+
+	cfg[0] = 1;			/* palette 1 */
+	for (i = 0; i < 8; i++) {
+		cfg[16 + 2 * i] = TILE_COLSB;	/* colsb[i], little endian */
+		cfg[48 + i] = TILE_ROWS;	/* rows[i] */
+	}
+	asm volatile("ldtilecfg %0" : : "m" (cfg));
+}
+#endif
+
+static struct copy_workload *copy_workload_of(struct work_instance *wi)
+{
+	return (struct copy_workload *)((char *)wi->workload -
+					offsetof(struct copy_workload, workload));
+}
+
 static int init(struct work_instance *wi)
 {
 	struct thread_data *dp;
+	struct copy_workload *cw = copy_workload_of(wi);
 
 	dp = (struct thread_data *)calloc(1, sizeof(struct thread_data));
 	if (!dp)
@@ -44,19 +185,21 @@ static int init(struct work_instance *wi)
 	if (wi->wi_bytes == 0)
 		wi->wi_bytes = SIZE_1GB * 1024;	/* small calibration buffer for high score */
 
-	if (wi->wi_bytes % (2 * MEM_BYTES_PER_ITERATION)) {
-		warnx("memcpy: %d bytes is invalid working set size.\n", wi->wi_bytes);
-		errx(-1, "memcpy: requires multiple of %d KB.\n",
-		     (2 * MEM_BYTES_PER_ITERATION) / 1024);
+	if (copy_block_bytes == 0 || copy_block_bytes % cw->block_align)
+		errx(-1, "%s: block size must be a multiple of %u bytes.\n",
+		     wi->workload->name, cw->block_align);
+
+	if (wi->wi_bytes % (2 * copy_block_bytes)) {
+		warnx("%s: %d bytes is invalid working set size.\n", wi->workload->name, wi->wi_bytes);
+		errx(-1, "%s: requires multiple of %d bytes.\n",
+		     wi->workload->name, 2 * copy_block_bytes);
 	}
 
-	dp->buf1 = malloc(wi->wi_bytes / 2);
-	dp->buf2 = malloc(wi->wi_bytes / 2);
+	dp->buf1 = worker_alloc(wi, wi->wi_bytes / 2);
+	dp->buf2 = worker_alloc(wi, wi->wi_bytes / 2);
 
-	if (!dp->buf1 || !dp->buf2) {
-		perror("malloc");
-		exit(-1);
-	}
+	if (cw->setup)
+		cw->setup();
 
 	wi->worker_data = dp;
 
@@ -67,8 +210,8 @@ static int cleanup(struct work_instance *wi)
 {
 	struct thread_data *dp = wi->worker_data;
 
-	free(dp->buf1);
-	free(dp->buf2);
+	worker_free(dp->buf1);
+	worker_free(dp->buf2);
 	free(dp);
 
 	wi->worker_data = NULL;
@@ -78,30 +221,33 @@ static int cleanup(struct work_instance *wi)
 
 /*
  * run()
- * MEM bytes_to_copy, or until tsc_end
- * return bytes copied
+ * copy -B sized blocks, repeat blocks or until -d is over
+ * return tsc at the end
  * use buf1 and buf2, in alternate directions
  */
 static unsigned long long run(struct work_instance *wi)
 {
 	char *src, *dst;
 	unsigned long long bytes_done;
-	unsigned long long bytes_to_copy = wi->repeat * MEM_BYTES_PER_ITERATION;
+	unsigned long long bytes_to_copy = (unsigned long long)wi->repeat * copy_block_bytes;
 	struct thread_data *dp = wi->worker_data;
+	void *(*copy)(void *dest, const void *src, size_t n) = copy_workload_of(wi)->copy;
 
 	src = dp->buf1;
 	dst = dp->buf2;
 
 	for (bytes_done = 0;;) {
-		int kb;
+		unsigned long long off;
 
-		for (kb = 0; kb < wi->wi_bytes / 1024 / 2; kb += 4) {
-			/* MEM 4KB */
-			memcpy(dst + kb * 1024, src + kb * 1024, MEM_BYTES_PER_ITERATION);
+		for (off = 0; off < wi->wi_bytes / 2; off += copy_block_bytes) {
+			copy(dst + off, src + off, copy_block_bytes);
 
-			bytes_done += MEM_BYTES_PER_ITERATION;
+			bytes_done += copy_block_bytes;
+			wi->stats->bytes = bytes_done;
 
 			thread_break(wi->break_reason, wi->thread_number);
+			if (worker_op_done(wi))
+				goto done;
 			if (bytes_to_copy && bytes_done >= bytes_to_copy)
 				goto done;
 		}
@@ -110,14 +256,67 @@ done:
 	return rdtsc();
 }
 
-static struct workload memcpy_workload = {
-	"memcpy",
-	init,
-	cleanup,
-	run,
-};
+#define COPY_WORKLOAD(_name, _copy, _setup, _align)			\
+	{								\
+		.workload = { _name, init, cleanup, run },		\
+		.copy = _copy, .setup = _setup, .block_align = _align	\
+	}
+
+static struct copy_workload memcpy_workload =
+	COPY_WORKLOAD("memcpy", memcpy, NULL, 1);
+static struct copy_workload movsb_workload =
+	COPY_WORKLOAD("memcpy_movsb", movsb_memcpy, NULL, 1);
+static struct copy_workload avx2_nt_workload =
+	COPY_WORKLOAD("memcpy_avx2_nt", avx2_nt_memcpy, NULL, 64);
+static struct copy_workload avx512_nt_workload =
+	COPY_WORKLOAD("memcpy_avx512_nt", avx512_nt_memcpy, NULL, 64);
+static struct copy_workload ntload_workload =
+	COPY_WORKLOAD("memcpy_ntload", ntload_memcpy, NULL, 64);
+#if __GNUC__ >= 11
+static struct copy_workload amx_workload =
+	COPY_WORKLOAD("memcpy_amx", amx_memcpy, amx_copy_setup, TILE_BYTES);
+#endif
 
 struct workload *register_memcpy(void)
 {
-	return &memcpy_workload;
+	return &memcpy_workload.workload;
+}
+
+struct workload *register_memcpy_movsb(void)
+{
+	return &movsb_workload.workload;
+}
+
+struct workload *register_memcpy_avx2_nt(void)
+{
+	if (cpuid.avx2)
+		return &avx2_nt_workload.workload;
+
+	return NULL;
+}
+
+struct workload *register_memcpy_avx512_nt(void)
+{
+	if (cpuid.avx512f)
+		return &avx512_nt_workload.workload;
+
+	return NULL;
+}
+
+struct workload *register_memcpy_ntload(void)
+{
+	if (cpuid.avx2)
+		return &ntload_workload.workload;
+
+	return NULL;
+}
+
+struct workload *register_memcpy_amx(void)
+{
+#if __GNUC__ >= 11
+	if (cpuid.amx_tile)
+		return &amx_workload.workload;
+#endif
+
+	return NULL;
 }
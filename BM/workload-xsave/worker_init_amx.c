@@ -34,27 +34,23 @@ static int init(struct work_instance *wi)
 
 	union __union_tile_config cfg;
 
+	/* once per thread, not in every timed work() call */
+	set_tiledata_use();
 	init_tile_config(&cfg, ROW_NUM, COL_NUM);
 
 	dp = (struct thread_data *)calloc(1, sizeof(struct thread_data));
 	if (!dp)
 		err(1, "thread_data");
 
-	dp->input_x = (int8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_x)
-		err(1, "calloc input_x");
+	dp->input_x = (int8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
-	dp->input_y = (int8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_y)
-		err(1, "calloc input_y");
+	dp->input_y = (int8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
 	/* initialize input -- make every iteration the same for now */
 	init_dword_tile(dp->input_x, ROW_NUM, COL_NUM, entries);
 	init_dword_tile(dp->input_y, ROW_NUM, COL_NUM, entries);
 
-	dp->output = (int32_t *) calloc(entries, BYTES_PER_VECTOR);
-	if (dp->output == NULL)
-		err(1, "calloc output");
+	dp->output = (int32_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
 	dp->data_entries = entries;
 
@@ -67,9 +63,9 @@ static int cleanup(struct work_instance *wi)
 {
 	struct thread_data *dp = wi->worker_data;
 
-	free(dp->input_x);
-	free(dp->input_y);
-	free(dp->output);
+	worker_free(dp->input_x);
+	worker_free(dp->input_y);
+	worker_free(dp->output);
 	free(dp);
 	wi->worker_data = NULL;
 
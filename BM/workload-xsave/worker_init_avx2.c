@@ -19,13 +19,9 @@ static int init(struct work_instance *wi)
 	if (!dp)
 		err(1, "thread_data");
 
-	dp->input_x = (uint8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_x)
-		err(1, "calloc input_x");
+	dp->input_x = (uint8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
-	dp->input_y = (int8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_y)
-		err(1, "calloc input_y");
+	dp->input_y = (int8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
 	/* initialize input -- make every iteration the same for now */
 	for (i = 0; i < entries; ++i) {
@@ -39,9 +35,7 @@ static int init(struct work_instance *wi)
 		}
 	}
 
-	dp->output = (int16_t *) calloc(entries, BYTES_PER_VECTOR);
-	if (dp->output == NULL)
-		err(1, "calloc output");
+	dp->output = (int16_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 	dp->data_entries = entries;
 
 	wi->worker_data = dp;
@@ -53,9 +47,9 @@ static int cleanup(struct work_instance *wi)
 {
 	struct thread_data *dp = wi->worker_data;
 
-	free(dp->input_x);
-	free(dp->input_y);
-	free(dp->output);
+	worker_free(dp->input_x);
+	worker_free(dp->input_y);
+	worker_free(dp->output);
 	free(dp);
 	wi->worker_data = NULL;
 
@@ -17,17 +17,11 @@ static int init(struct work_instance *wi)
 	if (!dp)
 		err(1, "thread_data");
 
-	dp->input_x = (uint8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_x)
-		err(1, "calloc input_x");
+	dp->input_x = (uint8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
-	dp->input_y = (int8_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_y)
-		err(1, "calloc input_y");
+	dp->input_y = (int8_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
-	dp->input_z = (int32_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->input_z)
-		err(1, "calloc input_z");
+	dp->input_z = (int32_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 
 	dp->input_ones = (int16_t *)calloc(1, BYTES_PER_VECTOR);
 	if (!dp->input_ones)
@@ -52,9 +46,7 @@ static int init(struct work_instance *wi)
 	for (i = 0; i < WORDS_PER_VECTOR; i++)
 		dp->input_ones[i] = 1;
 
-	dp->output = (int32_t *)calloc(entries, BYTES_PER_VECTOR);
-	if (!dp->output)
-		err(1, "calloc output");
+	dp->output = (int32_t *)worker_alloc(wi, (size_t)entries * BYTES_PER_VECTOR);
 	dp->data_entries = entries;
 
 	wi->worker_data = dp;
@@ -66,11 +58,11 @@ static int cleanup(struct work_instance *wi)
 {
 	struct thread_data *dp = wi->worker_data;
 
-	free(dp->input_x);
-	free(dp->input_y);
-	free(dp->input_z);
+	worker_free(dp->input_x);
+	worker_free(dp->input_y);
+	worker_free(dp->input_z);
 	free(dp->input_ones);
-	free(dp->output);
+	worker_free(dp->output);
 	free(dp);
 	wi->worker_data = NULL;
 
@@ -18,11 +18,19 @@
 #include <cpuid.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
 #include <linux/futex.h>
+#include <linux/mempolicy.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <limits.h>
 #include <x86intrin.h>
 #define YOGINI_MAIN
 #include "yogini.h"
@@ -37,6 +45,59 @@ enum {
 	BREAK_REASON_MAX = BREAK_BY_FUTEX
 } BREAK_REASON;
 #define FUTEX_VAL 0x5E5E5E5E
+/* pause iterations before a worker sleeps in the barrier */
+#define BARRIER_SPINS 1024
+
+enum {
+	PLACE_NONE = 0,
+	PLACE_LIST,
+	PLACE_CORE,
+	PLACE_SMT,
+	PLACE_NUMA,
+};
+
+struct perf_event_desc {
+	char *name;
+	__u32 type;
+	__u64 config;
+};
+
+#define HW_CACHE_READ_MISS(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/*
+ * Named events for -e. Model specific events such as L2 misses,
+ * core power licence levels or XSAVE assists are given raw as rUUEE.
+ */
+static struct perf_event_desc perf_event_table[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "l1d-misses", PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	{ "llc-misses", PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+	{ "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	{ NULL, 0, 0 }
+};
+
+#define PERF_DEFAULT_EVENTS "cycles,instructions,ref-cycles,l1d-misses,llc-misses"
+
+struct worker_buffer {
+	void *addr;
+	size_t len;
+	struct worker_buffer *next;
+};
+
+struct cpu_topo {
+	int cpu;
+	int package;
+	int core;
+	int sibling;	/* index of this CPU among its core's SMT siblings */
+	int node;
+};
 
 int repeat_cnt;
 int clfulsh;
@@ -46,17 +107,57 @@ struct work_instance *first_worker;
 struct work_instance *last_worker;
 
 static int num_worker_threads;
-static int num_checked_in_threads;
-static pthread_mutex_t checkin_mutex;
-static pthread_cond_t checkin_cv = PTHREAD_COND_INITIALIZER;
+static int barrier_count;
+static int barrier_sense;
+static int barrier_generation;	/* barriers passed in this trial */
+static int workers_running;
+static unsigned int kick_us = 50;
+static size_t page_bytes = 4096;
+static int page_flags;
+static int mem_node = -1;
+static struct worker_buffer *worker_buffers;
+static struct perf_event_desc perf_events[MAX_PERF_EVENTS];
+static int num_perf_events;
+static pthread_mutex_t worker_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
 int32_t break_reason = BREAK_BY_NOTHING;
 static int32_t *futex_ptr;
 static bool *thread_done;
 pthread_t *tid_ptr;
+static int placement = PLACE_NONE;
+static int *placement_cpus;
+static int num_placement_cpus;
+static struct worker_stats *stats_ptr;
+static unsigned long long *sampled_ops;
+static unsigned long long last_sample_ns;
+static unsigned int duration_sec;
+static unsigned int interval_ms;
+static unsigned int warmup_ms;
+static int num_trials = 1;
+static unsigned long long run_start_ns;
+int workers_stop;
 
 unsigned int SIZE_1GB = 1024 * 1024 * 1024;
 
 struct cpuid cpuid;
+unsigned long long tsc_per_sec;
+unsigned int copy_block_bytes = 4096;
+unsigned int gemm_m = 256, gemm_n = 256, gemm_k = 1024;
+
+static char *break_reason_names[] = {
+	"nothing", "yield", "sleep", "trap", "signal", "futex"
+};
+
+static char *output_file;
+static int output_csv;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 static void dump_command(int argc, char **argv)
 {
@@ -84,12 +185,27 @@ static void help(void)
 		"usage: %s [OPTIONS]\n"
 		"\n"
 		"%s runs some simple micro workloads\n"
-		"  -w, --workload [workload_name,threads#,break#, ...]\n", progname, progname);
+		"  -w, --workload [workload_name,threads#,break#, ...]\n"
+		"                 [workload_name+workload_name+...] to run one iteration of each in turn\n",
+		progname, progname);
 	fprintf(stderr, "Available workloads: ");
 	dump_workloads();
 	fprintf(stderr,
 		"  -r, --repeat, each instance needs to be run\n"
 		"  -b, --break_reason, [yield/sleep/trap/signal/futex]\n"
+		"  -p, --placement, [core/smt/numa/<cpu-list>] pin each worker to a CPU\n"
+		"  -d, --duration, seconds to run, instead of a repeat count\n"
+		"  -i, --interval, milliseconds between throughput samples\n"
+		"  -o, --output, file to write per-thread results to\n"
+		"  -F, --format, [json/csv] format of the output file, default json\n"
+		"  -k, --kick_interval, microseconds between signal/futex breaks, default 50\n"
+		"  -m, --page_size, [4k/2m/1g] page size backing workload buffers, default 4k\n"
+		"  -n, --mem_node, NUMA node to bind workload buffers to\n"
+		"  -B, --block_size, bytes per copy of the memcpy workloads, default 4096\n"
+		"  -e, --perf_events, [default/<event,...>] count events per worker, rUUEE for raw\n"
+		"  -g, --gemm, M,N,K of the AMX_GEMM workloads, default 256,256,1024\n"
+		"  -W, --warmup, milliseconds each worker runs before it is measured\n"
+		"  -T, --trials, run everything N times and report the spread\n"
 		"For more help, see README\n");
 	exit(0);
 }
@@ -111,6 +227,108 @@ int parse_break_cmd(char *input_string)
 	return 0;
 }
 
+static int parse_cpu_list(char *input_string)
+{
+	char *tok, *saveptr;
+	int first, last, cpu;
+
+	for (tok = strtok_r(input_string, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		switch (sscanf(tok, "%d-%d", &first, &last)) {
+		case 1:
+			last = first;
+			break;
+		case 2:
+			break;
+		default:
+			return -1;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return -1;
+
+		for (cpu = first; cpu <= last; cpu++) {
+			placement_cpus = realloc(placement_cpus,
+						 sizeof(int) * (num_placement_cpus + 1));
+			if (!placement_cpus)
+				err(1, "placement_cpus");
+			placement_cpus[num_placement_cpus++] = cpu;
+		}
+	}
+
+	return num_placement_cpus ? 0 : -1;
+}
+
+int parse_page_size_cmd(char *input_string)
+{
+	if (strcmp(input_string, "4k") == 0) {
+		page_bytes = 4096;
+		page_flags = 0;
+	} else if (strcmp(input_string, "2m") == 0) {
+		page_bytes = 2UL << 20;
+		page_flags = MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+	} else if (strcmp(input_string, "1g") == 0) {
+		page_bytes = 1UL << 30;
+		page_flags = MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+int parse_perf_cmd(char *input_string)
+{
+	char *tok, *saveptr, *end;
+	struct perf_event_desc *pe;
+
+	if (strcmp(input_string, "default") == 0)
+		input_string = strdup(PERF_DEFAULT_EVENTS);
+
+	for (tok = strtok_r(input_string, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (num_perf_events == MAX_PERF_EVENTS) {
+			fprintf(stderr, "At most %d perf events\n", MAX_PERF_EVENTS);
+			return -1;
+		}
+
+		for (pe = perf_event_table; pe->name; pe++)
+			if (strcmp(tok, pe->name) == 0)
+				break;
+
+		if (pe->name) {
+			perf_events[num_perf_events] = *pe;
+		} else if (tok[0] == 'r' && tok[1]) {
+			perf_events[num_perf_events].name = tok;
+			perf_events[num_perf_events].type = PERF_TYPE_RAW;
+			perf_events[num_perf_events].config = strtoull(tok + 1, &end, 16);
+			if (*end)
+				return -1;
+		} else {
+			fprintf(stderr, "Unknown perf event '%s'\n", tok);
+			return -1;
+		}
+		num_perf_events++;
+	}
+
+	return 0;
+}
+
+int parse_placement_cmd(char *input_string)
+{
+	if (strcmp(input_string, "none") == 0)
+		placement = PLACE_NONE;
+	else if (strcmp(input_string, "core") == 0)
+		placement = PLACE_CORE;
+	else if (strcmp(input_string, "smt") == 0)
+		placement = PLACE_SMT;
+	else if (strcmp(input_string, "numa") == 0)
+		placement = PLACE_NUMA;
+	else if (parse_cpu_list(input_string) == 0)
+		placement = PLACE_LIST;
+	else
+		return -1;
+	return 0;
+}
+
 static void set_tsc_per_sec(void)
 {
 	unsigned int ebx = 0, ecx = 0, edx = 0;
@@ -128,12 +346,20 @@ static void set_tsc_per_sec(void)
 
 		__cpuid_count(0x7, 0, eax_subleaves, ebx, ecx, edx);
 
+		if (ebx & (1 << 5))
+			cpuid.avx2 = 1;
 		if (ebx & (1 << 16))
 			cpuid.avx512f = 1;
 		if (ecx & (1 << 5))
 			cpuid.tpause = 1;
 		if (ecx & (1 << 11))
 			cpuid.vnni512 = 1;
+		if (edx & (1 << 22))
+			cpuid.amx_bf16 = 1;
+		if (edx & (1 << 24))
+			cpuid.amx_tile = 1;
+		if (edx & (1 << 25))
+			cpuid.amx_int8 = 1;
 
 		if (eax_subleaves > 0) {
 			unsigned int eax = 0;
@@ -147,6 +373,26 @@ static void set_tsc_per_sec(void)
 
 	if (max_level < 0x15)
 		errx(1, "sorry CPU too old: cpuid level 0x%x < 0x15", max_level);
+
+	/* Time Stamp Counter and Nominal Core Crystal Clock Information Leaf */
+	{
+		unsigned int eax_denominator = 0, ebx_numerator = 0, ecx_hz = 0;
+		unsigned long long bgn_ns, bgntsc;
+		struct timespec req = { 0, 50 * 1000 * 1000 };
+
+		__cpuid(0x15, eax_denominator, ebx_numerator, ecx_hz, edx);
+
+		if (eax_denominator && ebx_numerator && ecx_hz) {
+			tsc_per_sec = (unsigned long long)ecx_hz * ebx_numerator / eax_denominator;
+			return;
+		}
+
+		/* crystal clock not enumerated (e.g. in a guest), calibrate */
+		bgn_ns = now_ns();
+		bgntsc = rdtsc();
+		nanosleep(&req, NULL);
+		tsc_per_sec = (rdtsc() - bgntsc) * 1000000000ULL / (now_ns() - bgn_ns);
+	}
 }
 
 void register_all_workloads(void)
@@ -188,11 +434,118 @@ void register_new_worker(struct work_instance *wi)
 	wi->next = NULL;
 }
 
+/*
+ * A mixed worker runs one iteration of every workload of its sequence
+ * in turn, so the live xfeature set changes on every iteration.
+ * Each step is a private work_instance with its own worker_data.
+ */
+static int mix_initialize(struct work_instance *wi)
+{
+	struct work_instance *sub;
+
+	for (sub = wi->mix; sub; sub = sub->next) {
+		sub->thread_number = wi->thread_number;
+		sub->break_reason = wi->break_reason;
+		sub->wi_bytes = wi->wi_bytes;
+		sub->repeat = 1;
+		sub->cpu = wi->cpu;
+		sub->node = wi->node;
+
+		if (posix_memalign((void **)&sub->stats, 64, sizeof(struct worker_stats)))
+			err(1, "worker_stats");
+		memset(sub->stats, 0, sizeof(struct worker_stats));
+
+		if (sub->workload->initialize)
+			sub->workload->initialize(sub);
+	}
+
+	return 0;
+}
+
+static int mix_cleanup(struct work_instance *wi)
+{
+	struct work_instance *sub;
+
+	for (sub = wi->mix; sub; sub = sub->next) {
+		if (sub->workload->cleanup)
+			sub->workload->cleanup(sub);
+		free(sub->stats);
+		sub->stats = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * mix_run()
+ * one operation is one pass over the whole sequence
+ */
+static unsigned long long mix_run(struct work_instance *wi)
+{
+	struct work_instance *sub;
+	unsigned int count;
+	unsigned int operations = wi->repeat;
+
+	if (operations == 0)
+		operations = (~0U);
+
+	for (count = 0; count < operations; count++) {
+		for (sub = wi->mix; sub; sub = sub->next)
+			sub->workload->run(sub);
+		if (worker_op_done(wi))
+			break;
+	}
+
+	return rdtsc();
+}
+
+static int parse_mix_cmd(char *work_cmd)
+{
+	struct work_instance *wi, *sub, *last = NULL;
+	struct workload *wp;
+	char *copy, *tok, *saveptr;
+
+	wp = calloc(1, sizeof(struct workload));
+	copy = strdup(work_cmd);
+	if (!wp || !copy)
+		err(1, "mix workload");
+
+	wp->name = strdup(work_cmd);
+	wp->initialize = mix_initialize;
+	wp->cleanup = mix_cleanup;
+	wp->run = mix_run;
+
+	wi = alloc_new_work_instance();
+	wi->workload = wp;
+
+	for (tok = strtok_r(copy, "+", &saveptr); tok; tok = strtok_r(NULL, "+", &saveptr)) {
+		sub = alloc_new_work_instance();
+		sub->workload = find_workload(tok);
+		if (!sub->workload) {
+			fprintf(stderr, "Unrecognized work parameter '%s' try -h for help\n", tok);
+			exit(1);
+		}
+
+		if (last)
+			last->next = sub;
+		else
+			wi->mix = sub;
+		last = sub;
+	}
+	free(copy);
+
+	register_new_worker(wi);
+	return 0;
+}
+
 int parse_work_cmd(char *work_cmd)
 {
 	struct work_instance *wi;
 	struct workload *wp;
 
+	if (strchr(work_cmd, '+'))
+		return parse_mix_cmd(work_cmd);
+
 	wp = find_workload(work_cmd);
 	if (wp) {
 		wi = alloc_new_work_instance();
@@ -209,13 +562,31 @@ int parse_work_cmd(char *work_cmd)
 
 static void initial_ptr(void)
 {
+	struct work_instance *wi;
+	int i;
+
 	futex_ptr = (int32_t *)malloc(sizeof(int32_t) * num_worker_threads);
 	thread_done = (bool *)malloc(sizeof(bool) * num_worker_threads);
 	tid_ptr = (pthread_t *)malloc(sizeof(pthread_t) * num_worker_threads);
-	if (!futex_ptr || !thread_done || !tid_ptr) {
+	sampled_ops = calloc(num_worker_threads, sizeof(unsigned long long));
+	if (!futex_ptr || !thread_done || !tid_ptr || !sampled_ops) {
 		printf("Fail to malloc memory for futex_ptr & tid_ptr\n");
 		exit(1);
 	}
+
+	/* one set of stats per trial, all kept for the result file */
+	if (posix_memalign((void **)&stats_ptr, 64,
+			   sizeof(struct worker_stats) * num_worker_threads * num_trials))
+		err(1, "worker_stats");
+	memset(stats_ptr, 0, sizeof(struct worker_stats) * num_worker_threads * num_trials);
+
+	for (wi = first_worker, i = 0; wi; wi = wi->next, i++)
+		wi->stats = &stats_ptr[i];
+}
+
+static struct worker_stats *trial_stats(int trial, int thread)
+{
+	return &stats_ptr[trial * num_worker_threads + thread];
 }
 
 static void initial_wi(void)
@@ -226,12 +597,282 @@ static void initial_wi(void)
 	while (wi) {
 		wi->break_reason = break_reason;
 		wi->wi_bytes = SIZE_1GB;
-		wi->repeat = repeat_cnt;
+		/* a duration run ends on workers_stop, not on a count */
+		wi->repeat = duration_sec ? 0 : repeat_cnt;
 		wi = wi->next;
 		num_worker_threads++;
 	}
 }
 
+static int read_topology_int(int cpu, const char *name)
+{
+	char path[128];
+	FILE *fp;
+	int val;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+
+	return val;
+}
+
+static int cpu_to_node(int cpu)
+{
+	char path[64];
+	struct dirent *de;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((de = readdir(dir))) {
+		if (sscanf(de->d_name, "node%d", &node) == 1)
+			break;
+		node = -1;
+	}
+	closedir(dir);
+
+	return node;
+}
+
+static int cmp_topo_core(const void *a, const void *b)
+{
+	const struct cpu_topo *x = a, *y = b;
+
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static int cmp_topo_sibling(const void *a, const void *b)
+{
+	const struct cpu_topo *x = a, *y = b;
+
+	if (x->sibling != y->sibling)
+		return x->sibling - y->sibling;
+	return cmp_topo_core(a, b);
+}
+
+/*
+ * Build the order in which workers are assigned to CPUs, starting
+ * from the CPUs this process is allowed to run on:
+ * core: first SMT sibling of every core
+ * smt:  every CPU, siblings of one core next to each other
+ * numa: cores before siblings, round-robin across nodes
+ */
+static int build_cpu_order(struct cpu_topo **order)
+{
+	struct cpu_topo *topo, *out;
+	cpu_set_t allowed;
+	int i, j, n = 0, num_out = 0, max_node = -1;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		err(1, "sched_getaffinity");
+
+	topo = calloc(CPU_COUNT(&allowed), sizeof(struct cpu_topo));
+	out = calloc(CPU_COUNT(&allowed), sizeof(struct cpu_topo));
+	if (!topo || !out)
+		err(1, "cpu_topo");
+
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, &allowed))
+			continue;
+		topo[n].cpu = i;
+		topo[n].package = read_topology_int(i, "physical_package_id");
+		topo[n].core = read_topology_int(i, "core_id");
+		topo[n].node = cpu_to_node(i);
+		if (topo[n].node > max_node)
+			max_node = topo[n].node;
+		n++;
+	}
+
+	qsort(topo, n, sizeof(struct cpu_topo), cmp_topo_core);
+	for (i = 1; i < n; i++) {
+		if (topo[i].package == topo[i - 1].package &&
+		    topo[i].core == topo[i - 1].core)
+			topo[i].sibling = topo[i - 1].sibling + 1;
+	}
+
+	switch (placement) {
+	case PLACE_SMT:
+		memcpy(out, topo, n * sizeof(struct cpu_topo));
+		num_out = n;
+		break;
+	case PLACE_CORE:
+		for (i = 0; i < n; i++)
+			if (topo[i].sibling == 0)
+				out[num_out++] = topo[i];
+		break;
+	case PLACE_NUMA:
+		qsort(topo, n, sizeof(struct cpu_topo), cmp_topo_sibling);
+		while (num_out < n) {
+			for (j = -1; j <= max_node; j++) {
+				for (i = 0; i < n; i++) {
+					if (topo[i].cpu >= 0 && topo[i].node == j) {
+						out[num_out++] = topo[i];
+						topo[i].cpu = -1;
+						break;
+					}
+				}
+			}
+		}
+		break;
+	}
+
+	free(topo);
+	*order = out;
+
+	return num_out;
+}
+
+/* Assign wi->cpu and wi->node according to -p */
+static void initial_placement(void)
+{
+	struct work_instance *wi;
+	struct cpu_topo *order = NULL;
+	int i, num_cpus;
+
+	if (placement == PLACE_NONE) {
+		for (wi = first_worker; wi; wi = wi->next)
+			wi->cpu = wi->node = -1;
+		return;
+	}
+
+	if (placement == PLACE_LIST) {
+		cpu_set_t allowed;
+
+		if (sched_getaffinity(0, sizeof(allowed), &allowed))
+			err(1, "sched_getaffinity");
+
+		num_cpus = num_placement_cpus;
+		order = calloc(num_cpus, sizeof(struct cpu_topo));
+		if (!order)
+			err(1, "cpu_topo");
+		for (i = 0; i < num_cpus; i++) {
+			if (!CPU_ISSET(placement_cpus[i], &allowed))
+				errx(1, "placement: CPU %d is not available", placement_cpus[i]);
+			order[i].cpu = placement_cpus[i];
+			order[i].node = cpu_to_node(placement_cpus[i]);
+		}
+	} else {
+		num_cpus = build_cpu_order(&order);
+	}
+
+	if (num_cpus == 0)
+		errx(1, "placement: no CPU available");
+	if (num_worker_threads > num_cpus)
+		warnx("placement: %d workers share %d CPUs", num_worker_threads, num_cpus);
+
+	for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
+		wi->cpu = order[i % num_cpus].cpu;
+		wi->node = order[i % num_cpus].node;
+	}
+
+	free(order);
+}
+
+/*
+ * Prefer the local node of the worker for everything it allocates
+ * from now on, including worker_data set up by initialize().
+ */
+static void set_worker_mempolicy(struct work_instance *wi)
+{
+	unsigned long nodemask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = { 0 };
+
+	if (wi->node < 0 || wi->node >= CPU_SETSIZE)
+		return;
+
+	nodemask[wi->node / (8 * sizeof(unsigned long))] |=
+		1UL << (wi->node % (8 * sizeof(unsigned long)));
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, CPU_SETSIZE))
+		warn("set_mempolicy node %d", wi->node);
+}
+
+void *worker_alloc(struct work_instance *wi, size_t bytes)
+{
+	static int warned_fallback;
+	unsigned long nodemask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = { 0 };
+	struct worker_buffer *wb;
+	size_t len = (bytes + page_bytes - 1) & ~(page_bytes - 1);
+	int node = mem_node >= 0 ? mem_node : wi->node;
+	void *addr;
+	size_t off;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | page_flags, -1, 0);
+	if (addr == MAP_FAILED && page_flags) {
+		/* no hugetlbfs pages reserved, ask for THP instead */
+		if (!__atomic_exchange_n(&warned_fallback, 1, __ATOMIC_RELAXED))
+			warnx("no %zuKB hugepages available, falling back to THP", page_bytes >> 10);
+		len = (bytes + (2UL << 20) - 1) & ~((2UL << 20) - 1);
+		addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr != MAP_FAILED)
+			madvise(addr, len, MADV_HUGEPAGE);
+	}
+	if (addr == MAP_FAILED)
+		err(1, "mmap %zu bytes", len);
+
+	if (node >= 0 && node < CPU_SETSIZE) {
+		nodemask[node / (8 * sizeof(unsigned long))] |=
+			1UL << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, addr, len, MPOL_BIND, nodemask, CPU_SETSIZE, 0))
+			warn("mbind node %d", node);
+	}
+
+	/* fault every page in now, before the barrier */
+	for (off = 0; off < len; off += 4096)
+		((volatile char *)addr)[off] = 0;
+
+	wb = malloc(sizeof(struct worker_buffer));
+	if (!wb)
+		err(1, "worker_buffer");
+	wb->addr = addr;
+	wb->len = len;
+
+	pthread_mutex_lock(&worker_buffers_mutex);
+	wb->next = worker_buffers;
+	worker_buffers = wb;
+	pthread_mutex_unlock(&worker_buffers_mutex);
+
+	return addr;
+}
+
+void worker_free(void *addr)
+{
+	struct worker_buffer **pp, *wb = NULL;
+
+	if (!addr)
+		return;
+
+	pthread_mutex_lock(&worker_buffers_mutex);
+	for (pp = &worker_buffers; *pp; pp = &(*pp)->next) {
+		if ((*pp)->addr == addr) {
+			wb = *pp;
+			*pp = wb->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&worker_buffers_mutex);
+
+	if (!wb)
+		errx(1, "worker_free: %p was not allocated by worker_alloc", addr);
+
+	munmap(wb->addr, wb->len);
+	free(wb);
+}
+
 static void deinitialize(void)
 {
 	struct work_instance *wi;
@@ -240,6 +881,16 @@ static void deinitialize(void)
 	wi = first_worker;
 	while (wi) {
 		cur = wi->next;
+		if (wi->mix) {
+			struct work_instance *sub, *next;
+
+			for (sub = wi->mix; sub; sub = next) {
+				next = sub->next;
+				free(sub);
+			}
+			free(wi->workload->name);
+			free(wi->workload);
+		}
 		free(wi);
 		wi = cur;
 	}
@@ -247,6 +898,9 @@ static void deinitialize(void)
 	free(futex_ptr);
 	free(thread_done);
 	free(tid_ptr);
+	free(placement_cpus);
+	free(stats_ptr);
+	free(sampled_ops);
 }
 
 static void cmdline(int argc, char **argv)
@@ -259,6 +913,19 @@ static void cmdline(int argc, char **argv)
 		{ "repeat", required_argument, 0, 'r' },
 		{ "break_reason", required_argument, 0, 'b' },
 		{"clflush", no_argument, 0, 'f'},
+		{ "placement", required_argument, 0, 'p' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "interval", required_argument, 0, 'i' },
+		{ "output", required_argument, 0, 'o' },
+		{ "format", required_argument, 0, 'F' },
+		{ "kick_interval", required_argument, 0, 'k' },
+		{ "page_size", required_argument, 0, 'm' },
+		{ "mem_node", required_argument, 0, 'n' },
+		{ "block_size", required_argument, 0, 'B' },
+		{ "gemm", required_argument, 0, 'g' },
+		{ "perf_events", required_argument, 0, 'e' },
+		{ "warmup", required_argument, 0, 'W' },
+		{ "trials", required_argument, 0, 'T' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -267,7 +934,7 @@ static void cmdline(int argc, char **argv)
 	if (argc == 1)
 		help();
 
-	while ((opt = getopt_long_only(argc, argv, "h:w:r:b:f",
+	while ((opt = getopt_long_only(argc, argv, "h:w:r:b:fp:d:i:o:F:k:m:n:B:e:g:W:T:",
 				       long_options, &option_index)) != -1) {
 		switch (opt) {
 		case 'w':
@@ -284,6 +951,56 @@ static void cmdline(int argc, char **argv)
 		case 'f':
 			clfulsh = 1;
 			break;
+		case 'p':
+			if (parse_placement_cmd(optarg))
+				help();
+			break;
+		case 'd':
+			duration_sec = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'k':
+			kick_us = atoi(optarg);
+			break;
+		case 'm':
+			if (parse_page_size_cmd(optarg))
+				help();
+			break;
+		case 'n':
+			mem_node = atoi(optarg);
+			break;
+		case 'B':
+			copy_block_bytes = atoi(optarg);
+			break;
+		case 'e':
+			if (parse_perf_cmd(optarg))
+				help();
+			break;
+		case 'g':
+			if (sscanf(optarg, "%u,%u,%u", &gemm_m, &gemm_n, &gemm_k) != 3)
+				help();
+			break;
+		case 'W':
+			warmup_ms = atoi(optarg);
+			break;
+		case 'T':
+			num_trials = atoi(optarg);
+			if (num_trials < 1)
+				help();
+			break;
+		case 'F':
+			if (strcmp(optarg, "csv") == 0)
+				output_csv = 1;
+			else if (strcmp(optarg, "json") == 0)
+				output_csv = 0;
+			else
+				help();
+			break;
 		case '?':
 		case 'h':
 		default:
@@ -291,6 +1008,10 @@ static void cmdline(int argc, char **argv)
 		}
 	}
 
+	/* a duration run reports throughput every second by default */
+	if (duration_sec && !interval_ms)
+		interval_ms = 1000;
+
 	dump_command(argc, argv);
 }
 
@@ -300,6 +1021,7 @@ static void initialize(int argc, char **argv)
 	register_all_workloads();
 	cmdline(argc, argv);
 	initial_wi();
+	initial_placement();
 	initial_ptr();
 }
 
@@ -392,73 +1114,565 @@ void thread_break(int32_t reason, uint32_t thread_idx)
 	}
 }
 
+static long futex(int *uaddr, int op, int val, unsigned long long timeout_ns)
+{
+	struct timespec ts = {
+		.tv_sec = timeout_ns / 1000000000ULL,
+		.tv_nsec = timeout_ns % 1000000000ULL,
+	};
+
+	return syscall(SYS_futex, uaddr, op, val, timeout_ns ? &ts : NULL, NULL, 0);
+}
+
+/*
+ * worker_barrier()
+ * sense-reversing barrier: the last worker to arrive resets the count
+ * and flips barrier_sense, the others spin briefly on it and then
+ * sleep on it as a futex, so oversubscribed CPUs are not burned.
+ */
 static void worker_barrier(void)
 {
-	int i_am_last = 0;
+	static __thread int local_sense;
+	int spins;
+
+	local_sense = !local_sense;
+
+	if (__atomic_add_fetch(&barrier_count, 1, __ATOMIC_ACQ_REL) == num_worker_threads) {
+		__atomic_store_n(&barrier_count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&run_start_ns, now_ns(), __ATOMIC_RELAXED);
+		__atomic_add_fetch(&barrier_generation, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&barrier_sense, local_sense, __ATOMIC_RELEASE);
+		futex(&barrier_sense, FUTEX_WAKE_PRIVATE, INT_MAX, 0);
+		futex(&barrier_generation, FUTEX_WAKE_PRIVATE, INT_MAX, 0);
+		return;
+	}
+
+	for (spins = 0; __atomic_load_n(&barrier_sense, __ATOMIC_ACQUIRE) != local_sense; spins++) {
+		if (spins < BARRIER_SPINS)
+			_mm_pause();
+		else
+			futex(&barrier_sense, FUTEX_WAIT_PRIVATE, !local_sense, 0);
+	}
+}
 
-	pthread_mutex_lock(&checkin_mutex);
+static int perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+	int fd;
 
-	num_checked_in_threads += 1;
-	if (num_checked_in_threads == num_worker_threads)
-		i_am_last = 1;
+	/* this thread on any CPU, with kernel time if we are allowed to */
+	fd = syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+	if (fd < 0 && errno == EACCES) {
+		attr->exclude_kernel = 1;
+		fd = syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+	}
 
-	pthread_mutex_unlock(&checkin_mutex);
+	return fd;
+}
 
-	if (i_am_last) {
-		pthread_cond_broadcast(&checkin_cv);
-	} else {
-		/* wait for all workers to checkin */
-		pthread_mutex_lock(&checkin_mutex);
-		while (num_checked_in_threads < num_worker_threads)
-			if (pthread_cond_wait(&checkin_cv, &checkin_mutex))
-				err(1, "cond_wait: checkin_cv");
-		pthread_mutex_unlock(&checkin_mutex);
+/*
+ * perf_open()
+ * open the -e events of this worker as one group, disabled
+ * return the group leader fd, or -1 when not counting
+ */
+static int perf_open(struct work_instance *wi, int *fds)
+{
+	static int warned;
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < num_perf_events; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.disabled = i == 0;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP |
+			PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		fds[i] = perf_event_open(&attr, i ? fds[0] : -1);
+		if (fds[i] < 0) {
+			if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+				warn("perf_event_open %s, not counting", perf_events[i].name);
+			while (i--)
+				close(fds[i]);
+			return -1;
+		}
 	}
+
+	return num_perf_events ? fds[0] : -1;
+}
+
+static void perf_start(int leader)
+{
+	if (leader < 0)
+		return;
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* stop counting and scale the counts if the group was multiplexed */
+static void perf_stop(struct work_instance *wi, int leader, int *fds)
+{
+	unsigned long long buf[3 + MAX_PERF_EVENTS];
+	int i;
+
+	if (leader < 0)
+		return;
+
+	ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	if (read(leader, buf, sizeof(buf)) > 0 && buf[0] == num_perf_events && buf[2]) {
+		for (i = 0; i < num_perf_events; i++)
+			wi->stats->perf_counts[i] = buf[3 + i] * ((double)buf[1] / buf[2]);
+		wi->stats->perf_valid = 1;
+	}
+
+	for (i = 0; i < num_perf_events; i++)
+		close(fds[i]);
+}
+
+static unsigned long long perf_count(struct worker_stats *st, char *name)
+{
+	int i;
+
+	for (i = 0; i < num_perf_events; i++)
+		if (strcmp(perf_events[i].name, name) == 0)
+			return st->perf_counts[i];
+
+	return 0;
+}
+
+static void print_perf(struct work_instance *wi)
+{
+	struct worker_stats *st = wi->stats;
+	unsigned long long cycles, instructions, ref_cycles;
+	int i;
+
+	if (!st->perf_valid)
+		return;
+
+	printf("Thread %d:%s", wi->thread_number, wi->workload->name);
+	for (i = 0; i < num_perf_events; i++)
+		printf(" %s=%llu", perf_events[i].name, st->perf_counts[i]);
+
+	cycles = perf_count(st, "cycles");
+	instructions = perf_count(st, "instructions");
+	ref_cycles = perf_count(st, "ref-cycles");
+	if (cycles && instructions)
+		printf(" IPC=%.2f", (double)instructions / cycles);
+	/* below 1.0 when a licence level or power limit drops the frequency */
+	if (cycles && ref_cycles)
+		printf(" freq_ratio=%.2f", (double)cycles / ref_cycles);
+	printf("\n");
+}
+
+/*
+ * warm_up()
+ * run single operations for -W ms, so that page faults, cold caches,
+ * AMX state allocation and frequency ramp-up are not measured
+ */
+static void warm_up(struct work_instance *wi)
+{
+	unsigned int repeat = wi->repeat;
+	unsigned long long math_per_op = wi->stats->math_per_op;
+	unsigned long long end_ns = now_ns() + warmup_ms * 1000000ULL;
+
+	wi->repeat = 1;
+	while (now_ns() < end_ns)
+		wi->workload->run(wi);
+	wi->repeat = repeat;
+
+	memset(wi->stats, 0, sizeof(struct worker_stats));
+	wi->stats->math_per_op = math_per_op;
 }
 
 static void *worker_main(void *arg)
 {
-	// cpu_set_t mask;
-	// CPU_ZERO(&mask);
-	// CPU_SET(1, &mask);
-	// pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
 	struct work_instance *wi = (struct work_instance *)arg;
 
+	/* CPU affinity was set at creation, memory policy is per-thread */
+	set_worker_mempolicy(wi);
+	if (wi->cpu >= 0)
+		printf("Thread %d:%s placed on CPU %d node %d\n",
+		       wi->thread_number, wi->workload->name, wi->cpu, wi->node);
+
 	/* initialize data for this worker */
 	if (wi->workload->initialize)
 		wi->workload->initialize(wi);
 
+	int perf_fds[MAX_PERF_EVENTS];
+	int perf_leader = perf_open(wi, perf_fds);
+
 	worker_barrier();
 
+	/* everybody warms up together, then starts measuring together */
+	if (warmup_ms) {
+		warm_up(wi);
+		worker_barrier();
+	}
+
 	printf("%s will repeat %u in reason %d\n",
 	       wi->workload->name, wi->repeat, wi->break_reason);
 
 	unsigned long long bgntsc, endtsc;
 
+	perf_start(perf_leader);
 	bgntsc = rdtsc();
+	wi->stats->last_tsc = bgntsc;
 	endtsc = wi->workload->run(wi);
+	perf_stop(wi, perf_leader, perf_fds);
+	wi->stats->end_ns = now_ns();
+	wi->stats->cycles = endtsc - bgntsc;
+	wi->stats->cpu = sched_getcpu();
 	printf("Thread %d:%s took %llu clock-cycles, end in %llu.\n",
 	       wi->thread_number, wi->workload->name, endtsc - bgntsc, endtsc);
+	if (wi->stats->bytes && endtsc > bgntsc)
+		printf("Thread %d:%s copied %llu bytes, %.2f GB/s\n",
+		       wi->thread_number, wi->workload->name, wi->stats->bytes,
+		       wi->stats->bytes * (double)tsc_per_sec / (endtsc - bgntsc) / 1e9);
+	if (wi->stats->math_per_op && endtsc > bgntsc)
+		printf("Thread %d:%s %.3f TOPS\n", wi->thread_number, wi->workload->name,
+		       (double)wi->stats->ops * wi->stats->math_per_op *
+		       tsc_per_sec / (endtsc - bgntsc) / 1e12);
+	print_perf(wi);
 
 	/* cleanup data for this worker */
 	if (wi->workload->cleanup)
 		wi->workload->cleanup(wi);
 
-	thread_done[wi->thread_number] = true;
+	/* tell the main thread without making it poll */
+	__atomic_store_n(&thread_done[wi->thread_number], true, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&workers_running, 1, __ATOMIC_ACQ_REL);
+	futex(&workers_running, FUTEX_WAKE_PRIVATE, 1, 0);
+
 	pthread_exit((void *)0);
 	/* thread exit */
 }
 
+/*
+ * print_sample()
+ * print the throughput of every worker and of all workers
+ * since the previous sample
+ */
+static void print_sample(unsigned long long now)
+{
+	struct work_instance *wi;
+	unsigned long long ops, total = 0;
+	double secs;
+	int i;
+
+	secs = (now - last_sample_ns) / 1e9;
+
+	for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
+		ops = __atomic_load_n(&wi->stats->ops, __ATOMIC_RELAXED);
+		printf("%10.3f Thread %d:%s %.0f ops/s\n", (now - run_start_ns) / 1e9,
+		       wi->thread_number, wi->workload->name, (ops - sampled_ops[i]) / secs);
+		total += ops - sampled_ops[i];
+		sampled_ops[i] = ops;
+	}
+	printf("%10.3f Total %.0f ops/s\n", (now - run_start_ns) / 1e9, total / secs);
+
+	last_sample_ns = now;
+}
+
+static void print_summary(void)
+{
+	struct work_instance *wi;
+	unsigned long long total = 0, last_end_ns = run_start_ns;
+	double secs;
+
+	for (wi = first_worker; wi; wi = wi->next) {
+		secs = (wi->stats->end_ns - run_start_ns) / 1e9;
+		printf("Thread %d:%s completed %llu ops in %.3f seconds, %.0f ops/s\n",
+		       wi->thread_number, wi->workload->name, wi->stats->ops, secs,
+		       secs > 0 ? wi->stats->ops / secs : 0);
+		total += wi->stats->ops;
+		if (wi->stats->end_ns > last_end_ns)
+			last_end_ns = wi->stats->end_ns;
+	}
+
+	secs = (last_end_ns - run_start_ns) / 1e9;
+	printf("Total completed %llu ops in %.3f seconds, %.0f ops/s\n",
+	       total, secs, secs > 0 ? total / secs : 0);
+}
+
+static int last_hist_bucket(struct worker_stats *st)
+{
+	int b;
+
+	for (b = CYCLES_HIST_BUCKETS - 1; b > 0; b--)
+		if (st->cycles_hist[b])
+			break;
+
+	return b;
+}
+
+struct trial_spread {
+	double median, p5, p95, cv;
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* linear interpolation between the closest ranks */
+static double percentile(double *sorted, int n, double p)
+{
+	double rank = p * (n - 1);
+	int lo = rank;
+
+	if (lo + 1 >= n)
+		return sorted[n - 1];
+
+	return sorted[lo] + (rank - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+/* ops per second of run(), summed over the workers running "name" */
+static double trial_throughput(int trial, char *name)
+{
+	struct work_instance *wi;
+	struct worker_stats *st;
+	double total = 0;
+	int i;
+
+	for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
+		st = trial_stats(trial, i);
+		if (strcmp(wi->workload->name, name) == 0 && st->cycles)
+			total += st->ops * (double)tsc_per_sec / st->cycles;
+	}
+
+	return total;
+}
+
+static void get_trial_spread(char *name, struct trial_spread *sp)
+{
+	double *v, mean = 0, var = 0;
+	int t;
+
+	v = malloc(sizeof(double) * num_trials);
+	if (!v)
+		err(1, "trial_spread");
+
+	for (t = 0; t < num_trials; t++) {
+		v[t] = trial_throughput(t, name);
+		mean += v[t] / num_trials;
+	}
+	for (t = 0; t < num_trials; t++)
+		var += (v[t] - mean) * (v[t] - mean);
+	if (num_trials > 1)
+		var /= num_trials - 1;
+
+	qsort(v, num_trials, sizeof(double), cmp_double);
+	sp->median = percentile(v, num_trials, 0.5);
+	sp->p5 = percentile(v, num_trials, 0.05);
+	sp->p95 = percentile(v, num_trials, 0.95);
+	sp->cv = mean > 0 ? sqrt(var) / mean : 0;
+
+	free(v);
+}
+
+/* the first worker of every workload, so that each is reported once */
+static bool first_of_workload(struct work_instance *wi)
+{
+	struct work_instance *prev;
+
+	for (prev = first_worker; prev != wi; prev = prev->next)
+		if (strcmp(prev->workload->name, wi->workload->name) == 0)
+			return false;
+
+	return true;
+}
+
+static void print_trials(void)
+{
+	struct work_instance *wi;
+	struct trial_spread sp;
+
+	for (wi = first_worker; wi; wi = wi->next) {
+		if (!first_of_workload(wi))
+			continue;
+		get_trial_spread(wi->workload->name, &sp);
+		printf("%s: %d trials, median %.0f ops/s, p5 %.0f, p95 %.0f, CV %.2f%%\n",
+		       wi->workload->name, num_trials, sp.median, sp.p5, sp.p95, sp.cv * 100);
+	}
+}
+
+static void write_json(FILE *fp)
+{
+	struct work_instance *wi;
+	struct worker_stats *st;
+	struct trial_spread sp;
+	int b, last, i, t;
+	bool first = true;
+
+	fprintf(fp, "{\n  \"tsc_hz\": %llu,\n  \"warmup_ms\": %u,\n  \"trials\": %d,\n",
+		tsc_per_sec, warmup_ms, num_trials);
+
+	/* ops/s of run() per workload, over the trials */
+	fprintf(fp, "  \"summary\": [");
+	for (wi = first_worker; wi; wi = wi->next) {
+		if (!first_of_workload(wi))
+			continue;
+		get_trial_spread(wi->workload->name, &sp);
+		fprintf(fp, "%s\n    { \"workload\": \"%s\", \"median\": %.1f, \"p5\": %.1f, "
+			"\"p95\": %.1f, \"cv\": %.6f }", first ? "" : ",",
+			wi->workload->name, sp.median, sp.p5, sp.p95, sp.cv);
+		first = false;
+	}
+	fprintf(fp, "\n  ],\n  \"workers\": [");
+
+	first = true;
+	for (t = 0; t < num_trials; t++) {
+		for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
+			st = trial_stats(t, i);
+			fprintf(fp, "%s\n    {\n", first ? "" : ",");
+			first = false;
+			fprintf(fp, "      \"workload\": \"%s\",\n", wi->workload->name);
+			fprintf(fp, "      \"break_reason\": \"%s\",\n",
+				break_reason_names[wi->break_reason]);
+			fprintf(fp, "      \"trial\": %d,\n", t);
+			fprintf(fp, "      \"thread\": %d,\n", wi->thread_number);
+			fprintf(fp, "      \"cpu\": %d,\n", st->cpu);
+			fprintf(fp, "      \"cycles\": %llu,\n", st->cycles);
+			fprintf(fp, "      \"ops\": %llu,\n", st->ops);
+			fprintf(fp, "      \"bytes\": %llu,\n", st->bytes);
+			fprintf(fp, "      \"math_per_op\": %llu,\n", st->math_per_op);
+			if (st->perf_valid) {
+				fprintf(fp, "      \"perf\": {");
+				for (b = 0; b < num_perf_events; b++)
+					fprintf(fp, "%s\"%s\": %llu", b ? ", " : " ",
+						perf_events[b].name, st->perf_counts[b]);
+				fprintf(fp, " },\n");
+			}
+			/* bucket n counts operations taking [2^n, 2^(n+1)) cycles */
+			fprintf(fp, "      \"cycles_log2_hist\": [");
+			last = last_hist_bucket(st);
+			for (b = 0; b <= last; b++)
+				fprintf(fp, "%s%llu", b ? ", " : "", st->cycles_hist[b]);
+			fprintf(fp, "]\n    }");
+		}
+	}
+	fprintf(fp, "\n  ]\n}\n");
+}
+
+static void write_csv(FILE *fp)
+{
+	struct work_instance *wi;
+	struct worker_stats *st;
+	int b, i, t;
+
+	fprintf(fp, "workload,break_reason,trial,thread,cpu,tsc_hz,cycles,ops,bytes,math_per_op");
+	for (b = 0; b < num_perf_events; b++)
+		fprintf(fp, ",%s", perf_events[b].name);
+	for (b = 0; b < CYCLES_HIST_BUCKETS; b++)
+		fprintf(fp, ",hist_2^%d", b);
+	fprintf(fp, "\n");
+
+	for (t = 0; t < num_trials; t++) {
+		for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
+			st = trial_stats(t, i);
+			fprintf(fp, "%s,%s,%d,%d,%d,%llu,%llu,%llu,%llu,%llu", wi->workload->name,
+				break_reason_names[wi->break_reason], t, wi->thread_number,
+				st->cpu, tsc_per_sec, st->cycles, st->ops,
+				st->bytes, st->math_per_op);
+			/* empty when the counters could not be opened */
+			for (b = 0; b < num_perf_events; b++)
+				if (st->perf_valid)
+					fprintf(fp, ",%llu", st->perf_counts[b]);
+				else
+					fprintf(fp, ",");
+			for (b = 0; b < CYCLES_HIST_BUCKETS; b++)
+				fprintf(fp, ",%llu", st->cycles_hist[b]);
+			fprintf(fp, "\n");
+		}
+	}
+}
+
+static void write_output(void)
+{
+	FILE *fp;
+
+	if (!output_file)
+		return;
+
+	fp = fopen(output_file, "w");
+	if (!fp)
+		err(1, "%s", output_file);
+
+	if (output_csv)
+		write_csv(fp);
+	else
+		write_json(fp);
+
+	fclose(fp);
+}
+
+/*
+ * controller_cpu()
+ * CPU 0 as before, unless workers were placed there while another
+ * allowed CPU has no worker to disturb
+ */
+static int controller_cpu(void)
+{
+	struct work_instance *wi;
+	cpu_set_t allowed;
+	int cpu;
+
+	if (placement == PLACE_NONE || sched_getaffinity(0, sizeof(allowed), &allowed))
+		return 0;
+
+	for (wi = first_worker; wi; wi = wi->next)
+		CPU_CLR(wi->cpu, &allowed);
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &allowed))
+			return cpu;
+
+	return 0;
+}
+
+/*
+ * wait_for_barrier()
+ * sleep until the workers passed "generation" barriers of this trial
+ * or timeout_ns passed, 0 waits forever
+ */
+static void wait_for_barrier(int generation, unsigned long long timeout_ns)
+{
+	int gen = __atomic_load_n(&barrier_generation, __ATOMIC_ACQUIRE);
+
+	if (gen < generation)
+		futex(&barrier_generation, FUTEX_WAIT_PRIVATE, gen, timeout_ns);
+}
+
+/*
+ * wait_for_workers()
+ * sleep until a worker exits or timeout_ns passed, 0 waits forever
+ */
+static void wait_for_workers(unsigned long long timeout_ns)
+{
+	int running = __atomic_load_n(&workers_running, __ATOMIC_ACQUIRE);
+
+	if (running)
+		futex(&workers_running, FUTEX_WAIT_PRIVATE, running, timeout_ns);
+}
+
 static void start_and_wait_for_workers(void)
 {
 	int i;
 	cpu_set_t mask;
 	struct work_instance *wi;
 	struct sigaction sigact;
-	bool all_thread_done = false;
+	unsigned long long now, wakeup_ns, next_sample_ns = 0, end_ns = 0;
+	int measure_generation = warmup_ms ? 2 : 1;
+	bool kick, measuring = false;
 
 	CPU_ZERO(&mask);
-	CPU_SET(0, &mask);
+	CPU_SET(controller_cpu(), &mask);
 	pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
 
 	if (break_reason == BREAK_BY_TRAP) {
@@ -476,6 +1690,7 @@ static void start_and_wait_for_workers(void)
 	}
 
 	/* create workers */
+	workers_running = num_worker_threads;
 	for (wi = first_worker, i = 0; wi; wi = wi->next, i++) {
 		futex_ptr[i] = FUTEX_VAL;
 		thread_done[i] = false;
@@ -485,55 +1700,118 @@ static void start_and_wait_for_workers(void)
 		pthread_attr_init(&attr);
 		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
+		/* pin before the worker runs initialize() */
+		if (wi->cpu >= 0) {
+			CPU_ZERO(&mask);
+			CPU_SET(wi->cpu, &mask);
+			if (pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask))
+				errx(1, "pthread_attr_setaffinity_np CPU %d", wi->cpu);
+		}
+
 		if (pthread_create(&tid_ptr[i], &attr, &worker_main, wi) != 0)
 			err(1, "pthread_create");
 
 		wi->thread_id = tid_ptr[i];
+		pthread_attr_destroy(&attr);
 	}
 
-	sleep(1);
+	kick = break_reason == BREAK_BY_SIGNAL || break_reason == BREAK_BY_FUTEX;
+	if (!kick && !interval_ms)
+		goto join;
 
-	if (break_reason == BREAK_BY_SIGNAL) {
-		while (!all_thread_done) {
-			all_thread_done = true;
-			for (i = 0; i < num_worker_threads; i++) {
-				if (!thread_done[i]) {
-					pthread_kill(tid_ptr[i], SIGUSR1);
-					all_thread_done = false;
-					/*
-					 * wait 0.5 second to prevent from
-					 * sending signal too frequently
-					 */
-					usleep(1);
-				}
-			}
+	/* the last worker through a barrier wakes us up as well */
+	while (__atomic_load_n(&barrier_generation, __ATOMIC_ACQUIRE) < 1)
+		wait_for_barrier(1, 0);
+
+	while (__atomic_load_n(&workers_running, __ATOMIC_ACQUIRE)) {
+		for (i = 0; kick && i < num_worker_threads; i++) {
+			if (__atomic_load_n(&thread_done[i], __ATOMIC_ACQUIRE))
+				continue;
+
+			if (break_reason == BREAK_BY_SIGNAL)
+				pthread_kill(tid_ptr[i], SIGUSR1);
+			/* Wake up the sub-thread waiting on a futex */
+			if (break_reason == BREAK_BY_FUTEX)
+				futex(&futex_ptr[i], FUTEX_WAKE, 1, 0);
 		}
-	}
 
-	/* Wake up the sub-thread waiting on a futex */
-	if (break_reason == BREAK_BY_FUTEX) {
-		while (!all_thread_done) {
-			all_thread_done = true;
-			for (i = 0; i < num_worker_threads; i++) {
-				if (!thread_done[i]) {
-					syscall(SYS_futex, &futex_ptr[i], FUTEX_WAKE, 1, 0, 0, 0);
-					all_thread_done = false;
-					/* wait 0.5 second to prevent from printing too much */
-					usleep(1);
-				}
+		if (!measuring) {
+			/* warming up, only the breaks need us */
+			if (__atomic_load_n(&barrier_generation, __ATOMIC_ACQUIRE) <
+			    measure_generation) {
+				wait_for_barrier(measure_generation, kick ? kick_us * 1000ULL : 0);
+				continue;
 			}
+			measuring = true;
+			last_sample_ns = run_start_ns;
+			next_sample_ns = run_start_ns + interval_ms * 1000000ULL;
+			end_ns = run_start_ns + duration_sec * 1000000000ULL;
+		}
+
+		now = now_ns();
+		if (interval_ms && now >= next_sample_ns) {
+			print_sample(now);
+			next_sample_ns += interval_ms * 1000000ULL;
 		}
+		if (duration_sec && now >= end_ns)
+			__atomic_store_n(&workers_stop, 1, __ATOMIC_RELAXED);
+
+		/* sleep until the next break, sample or stop, or a worker exits */
+		wakeup_ns = interval_ms ? next_sample_ns : ~0ULL;
+		if (duration_sec && !workers_stop && end_ns < wakeup_ns)
+			wakeup_ns = end_ns;
+		if (kick && now + kick_us * 1000ULL < wakeup_ns)
+			wakeup_ns = now + kick_us * 1000ULL;
+
+		now = now_ns();
+		if (wakeup_ns > now)
+			wait_for_workers(wakeup_ns == ~0ULL ? 0 : wakeup_ns - now);
 	}
 
+join:
+
 	/* wait for all workers to join */
 	for (wi = first_worker, i = 0; wi; wi = wi->next, ++i)
 		if (pthread_join(tid_ptr[i], NULL) != 0)
 			err(0, "thread %ld failed to join\n", wi->thread_id);
+
+	if (interval_ms)
+		print_summary();
+}
+
+/*
+ * start_trial()
+ * point the workers at the stats of this trial and clear what the
+ * previous trial left behind, new threads start with a fresh sense
+ */
+static void start_trial(int trial)
+{
+	struct work_instance *wi;
+	int i;
+
+	for (wi = first_worker, i = 0; wi; wi = wi->next, i++)
+		wi->stats = trial_stats(trial, i);
+
+	memset(sampled_ops, 0, sizeof(unsigned long long) * num_worker_threads);
+	barrier_sense = 0;
+	barrier_generation = 0;
+	workers_stop = 0;
+
+	if (num_trials > 1)
+		printf("Trial %d of %d\n", trial + 1, num_trials);
 }
 
 int main(int argc, char **argv)
 {
+	int trial;
+
 	initialize(argc, argv);
-	start_and_wait_for_workers();
+	for (trial = 0; trial < num_trials; trial++) {
+		start_trial(trial);
+		start_and_wait_for_workers();
+	}
+	if (num_trials > 1)
+		print_trials();
+	write_output();
 	deinitialize();
 }
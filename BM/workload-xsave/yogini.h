@@ -17,6 +17,27 @@
 #define CMAKE_FLAG 1
 #endif
 
+#define CYCLES_HIST_BUCKETS 64
+#define MAX_PERF_EVENTS 8
+
+/*
+ * Progress of one worker, written only by the worker itself and
+ * sampled by the main thread. Padded so workers never share a line.
+ */
+struct worker_stats {
+	unsigned long long ops;		/* completed operations */
+	unsigned long long end_ns;	/* CLOCK_MONOTONIC when run() returned */
+	unsigned long long cycles;	/* TSC cycles spent in run() */
+	unsigned long long last_tsc;	/* TSC at the end of the previous operation */
+	unsigned long long bytes;	/* bytes moved, for copy workloads */
+	unsigned long long math_per_op;	/* multiplies + adds per op, for TOPS */
+	int cpu;			/* CPU the worker finished on */
+	int perf_valid;			/* perf_counts were collected */
+	unsigned long long perf_counts[MAX_PERF_EVENTS];	/* in -e order, scaled */
+	/* operations taking [2^n, 2^(n+1)) TSC cycles, including thread_break() */
+	unsigned long long cycles_hist[CYCLES_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
 struct work_instance {
 	struct work_instance *next;
 	pthread_t thread_id;
@@ -26,6 +47,10 @@ struct work_instance {
 	unsigned int repeat;
 	unsigned int wi_bytes;
 	int break_reason;
+	int cpu;		/* -1: not pinned */
+	int node;		/* -1: no memory policy */
+	struct worker_stats *stats;
+	struct work_instance *mix;	/* sequence run by a "A+B+..." worker */
 };
 
 struct workload {
@@ -54,9 +79,20 @@ extern struct workload *register_FP64(void);
 extern struct workload *register_SSE(void);
 extern struct workload *register_MEM(void);
 extern struct workload *register_memcpy(void);
+extern struct workload *register_memcpy_movsb(void);
+extern struct workload *register_memcpy_avx2_nt(void);
+extern struct workload *register_memcpy_avx512_nt(void);
+extern struct workload *register_memcpy_ntload(void);
+extern struct workload *register_memcpy_amx(void);
 extern struct workload *register_AMX(void);
+extern struct workload *register_AMX_GEMM(void);
+extern struct workload *register_AMX_GEMM_BF16(void);
 
 extern unsigned int SIZE_1GB;
+extern unsigned long long tsc_per_sec;
+extern unsigned int copy_block_bytes;
+extern unsigned int gemm_m, gemm_n, gemm_k;
+extern int workers_stop;
 
 #ifdef YOGINI_MAIN
 struct workload *(*all_register_routines[]) () = {
@@ -87,8 +123,15 @@ struct workload *(*all_register_routines[]) () = {
 #endif
 	register_MEM,
 	register_memcpy,
+	register_memcpy_movsb,
+	register_memcpy_avx2_nt,
+	register_memcpy_avx512_nt,
+	register_memcpy_ntload,
+	register_memcpy_amx,
 #if MAMX_ENABLED || CMAKE_FLAG
 	register_AMX,
+	register_AMX_GEMM,
+	register_AMX_GEMM_BF16,
 #endif
 	NULL
 };
@@ -114,6 +157,32 @@ static inline unsigned long long rdtsc(void)
 	return low | ((unsigned long long)high) << 32;
 }
 
+/*
+ * worker_op_done()
+ * publish one more completed operation of this worker
+ * return non-zero when the run is over and the worker should stop
+ */
+static inline int worker_op_done(struct work_instance *wi)
+{
+	struct worker_stats *st = wi->stats;
+	unsigned long long tsc = rdtsc();
+
+	st->cycles_hist[63 - __builtin_clzll((tsc - st->last_tsc) | 1)]++;
+	st->last_tsc = tsc;
+	__atomic_store_n(&st->ops, st->ops + 1, __ATOMIC_RELAXED);
+
+	return __atomic_load_n(&workers_stop, __ATOMIC_RELAXED);
+}
+
+/*
+ * Buffers of memory-bound workloads: page aligned (so also cache-line
+ * aligned), backed by the page size of -m, bound to -n or the worker's
+ * node, and pre-faulted so the first iterations do not take faults.
+ * Zero filled, like calloc(3).
+ */
+void *worker_alloc(struct work_instance *wi, size_t bytes);
+void worker_free(void *addr);
+
 void clflush_range(void *address, size_t size);
 extern int clfulsh;
 struct cpuid {
@@ -121,6 +190,10 @@ struct cpuid {
 	unsigned int vnni512;
 	unsigned int avx2vnni;
 	unsigned int tpause;
+	unsigned int avx2;
+	unsigned int amx_tile;
+	unsigned int amx_int8;
+	unsigned int amx_bf16;
 };
 
 extern struct cpuid cpuid;